@@ -0,0 +1,71 @@
+// DisplayGeometry.cpp
+#include <cmath>
+#include "DisplayGeometry.h"
+
+static const double RAD_TO_DEG = 180.0/M_PI;
+
+DisplayGeometry::DisplayGeometry(){
+	clear();
+}
+
+void DisplayGeometry::clear(){
+	width_mm = height_mm = distance_mm = 0.0;
+	res_x = res_y = 0;
+	use_sample_resolution = false;
+	configured = false;
+	x_lut.clear();
+	y_lut.clear();
+}
+
+void DisplayGeometry::configure(double width_mm, double height_mm, int res_x, int res_y,
+	double distance_mm, bool use_sample_resolution){
+	clear();
+	if((width_mm<=0)||(height_mm<=0)||(res_x<=0)||(res_y<=0)||(distance_mm<=0)){
+		return;
+	}
+	this->width_mm = width_mm;
+	this->height_mm = height_mm;
+	this->res_x = res_x;
+	this->res_y = res_y;
+	this->distance_mm = distance_mm;
+	this->use_sample_resolution = use_sample_resolution;
+	center = Point2D(0.5*res_x,0.5*res_y);
+	mm_per_px = Point2D(width_mm/res_x,height_mm/res_y);
+	// tabulate the (nonlinear) pixel-to-angle mapping at every pixel boundary
+	x_lut.resize(res_x+1);
+	for(int i=0;i<=res_x;++i){
+		x_lut[i] = pixelToDegrees(i,center.x,mm_per_px.x);
+	}
+	y_lut.resize(res_y+1);
+	for(int i=0;i<=res_y;++i){
+		y_lut[i] = pixelToDegrees(i,center.y,mm_per_px.y);
+	}
+	configured = true;
+}
+
+double DisplayGeometry::pixelToDegrees(double px, double c, double mm_per_px) const{
+	return atan((px-c)*mm_per_px/distance_mm)*RAD_TO_DEG;
+}
+
+double DisplayGeometry::lookup(const std::vector<double> &lut, double px, double c, double mm_per_px) const{
+	const int n = lut.size()-1;
+	if(!(px>=0.0)||!(px<n)){
+		// off-screen (or missing) samples are rare; compute these directly
+		return pixelToDegrees(px,c,mm_per_px);
+	}
+	// linearly interpolate between neighbouring pixel boundaries
+	const int i = (int) px;
+	const double f = px-i;
+	return lut[i]+f*(lut[i+1]-lut[i]);
+}
+
+Point2D DisplayGeometry::toDegrees(const Point2D &px, const Point2D &ppd) const{
+	if(!configured){
+		return px;
+	}
+	if(use_sample_resolution&&(ppd.x>0.0)&&(ppd.y>0.0)){
+		return Point2D((px.x-center.x)/ppd.x,(px.y-center.y)/ppd.y);
+	}
+	return Point2D(lookup(x_lut,px.x,center.x,mm_per_px.x),
+		lookup(y_lut,px.y,center.y,mm_per_px.y));
+}
@@ -0,0 +1,33 @@
+// DisplayGeometry.h
+// Maps screen (pixel) coordinates to degrees of visual angle for a flat display
+// viewed head-on from a fixed distance. Conversions are done via a lookup table
+// (built once per configuration) so they are cheap enough for the sampling thread.
+#pragma once
+#include <vector>
+#include "Point2D.h"
+
+class DisplayGeometry{
+	double width_mm, height_mm;	// physical size of the visible screen area
+	int res_x, res_y;		// screen resolution in pixels
+	double distance_mm;		// eye-to-screen distance
+	bool use_sample_resolution;	// use per-sample pixels/degree (FSAMPLE.rx/ry) instead
+	bool configured;
+	Point2D center;			// screen center in pixels
+	Point2D mm_per_px;
+	std::vector<double> x_lut;	// eccentricity (deg) at each pixel column boundary
+	std::vector<double> y_lut;	// eccentricity (deg) at each pixel row boundary
+	double pixelToDegrees(double px, double c, double mm_per_px) const;
+	double lookup(const std::vector<double> &lut, double px, double c, double mm_per_px) const;
+public:
+	DisplayGeometry();
+	void configure(double width_mm, double height_mm, int res_x, int res_y,
+		double distance_mm, bool use_sample_resolution=false);
+	void clear();
+	bool isConfigured() const {return configured;}
+	bool usesSampleResolution() const {return use_sample_resolution;}
+	// Converts a screen position to degrees of visual angle relative to the
+	// screen center (+x rightward, +y downward, as in screen coordinates).
+	// 'ppd' holds the tracker's pixels/degree estimate for this sample and is
+	// only used if the geometry was configured with use_sample_resolution.
+	Point2D toDegrees(const Point2D &px, const Point2D &ppd) const;
+};
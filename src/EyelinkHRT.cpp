@@ -8,67 +8,115 @@ namespace chrono = stdx::chrono;
 using std::ofstream;
 using std::ostringstream;
 using chrono::milliseconds;
-typedef chrono::high_resolution_clock hr_clock;
+using chrono::microseconds;
+typedef chrono::steady_clock hr_clock; // monotonic, so sample intervals are never negative
 using std::vector;
 
+// How long before each poll the sampling thread stops sleeping and spins
+static const microseconds SPIN_TIME(1000);
+
 //EyelinkHRT member functions
 
 void EyelinkHRT::track(){
+	hr_clock::time_point next_poll = hr_clock::now();
+	stdx::unique_lock<stdx::mutex> lock(mutex);
 	while(thread_alive){
-		mutex.lock();
-		HRTState localstate = state;
-		mutex.unlock();
-
-		if(localstate==HRT_STOPPED){
-			// do nothing
-			// stdx::this_thread::yield();
-		}else if(localstate==HRT_TRACKING){
-			mutex.lock();
-			current_pos = eyetracker->getGazePosition();
-			//start_time = hr_clock::now();
-			//////////////////////////
-			//// Treat short_gazelist as a limited_capacity stack
-			//// and push down the current GazeDatum
-			short_gazelist[2] = short_gazelist[1];
-			short_gazelist[1] = short_gazelist[0];
-			short_gazelist[0] = GazeDatum(current_pos,0);
-			updateCurrentVelocityAndAccel();
-			//////////////////////////
-			mutex.unlock();
-		}else if(localstate==HRT_RECORDING){
-			mutex.lock();
-			// update gaze position information
-			current_pos = eyetracker->getGazePosition();
-			current_time = chrono::duration_cast<milliseconds>(hr_clock::now()-start_time);
-			GazeDatum gd(current_pos,(int) current_time.count());
-			gaze_data.push_back(gd);
-			// check for blink
-			blink_detected = eyetracker->getBlinkSignal();
-			if(current_time>MAX_TRACK_TIME){
-				stopRecording();
-			}
-			//////////////////////////
-			//// Treat short_gazelist as a limited_capacity stack
-			//// and push down the current GazeDatum
-			short_gazelist[2] = short_gazelist[1];
-			short_gazelist[1] = short_gazelist[0];
-			short_gazelist[0] = gd;
-			updateCurrentVelocityAndAccel();
-			//////////////////////////
-			mutex.unlock();
+		if(state==HRT_STOPPED){
+			// sleep until tracking starts (or the tracker is deleted)
+			state_cv.wait(lock);
+			next_poll = hr_clock::now();
+			continue;
 		}
+		// process every tracker sample that has arrived since the last poll;
+		// polls that find no new sample leave the estimates untouched
+		while(eyetracker->nextSample()){
+			processSample();
+		}
+		next_poll += temporal_resolution;
+		hr_clock::time_point now = hr_clock::now();
+		if(next_poll<now){
+			next_poll = now; // don't try to catch up on missed polls
+		}
+		lock.unlock();
+		// Samples carry their own timestamps, but the current position and any
+		// pending waitFor() are only as fresh as the last poll. The sleep
+		// functions are unreliable at this scale (a wakeup can be a whole timer
+		// tick, ~15.6 ms by default on Windows, late), so we only sleep until
+		// shortly before the poll and spin for the rest. At the default 1 ms
+		// resolution, this keeps a tracking thread busy, as it always was.
+		if(next_poll-now>SPIN_TIME){
+			stdx::this_thread::sleep_until(next_poll-SPIN_TIME);
+		}
+		while(hr_clock::now()<next_poll){} // explicit wait
+		lock.lock();
+	}
+}
 
-		if(localstate!=HRT_STOPPED){ // i.e., if we're tracking or recording eye movements
-			//stdx::this_thread::sleep_for(temporal_resolution);
-			//stdx::this_thread::sleep_until(start_time+current_time+temporal_resolution);
-
-			// The two sleep functions above are unreliable, so we have to keep the thread active
-			hr_clock::time_point desired_time = start_time+current_time+temporal_resolution;
-			while(hr_clock::now()<desired_time){} // explicit wait
+void EyelinkHRT::processSample(){
+	// Must be called with the mutex held, after eyetracker->nextSample()
+	GazeDatum gd = acquireSample();
+	if(state==HRT_RECORDING){
+		gaze_data.push_back(gd);
+		// check for blink
+		blink_detected = current_blink;
+		if(current_time>MAX_TRACK_TIME){
+			// equivalent to stopRecording(), but we already hold the mutex
+			state = HRT_TRACKING;
+			blink_detected = false;
 		}
 	}
+	kinematics.addSample(gd);
+	updateQuality(gd);
+	if(heatmap.isEnabled()&&heatmap.addSample(gd.pos,gd.time)){
+		flushHeatmap();
+	}
+	if(wait_pending){
+		updateWaitCondition();
+	}
+}
+
+void EyelinkHRT::restartClock(){
+	// Must be called with the mutex held. Samples that queued up before now are
+	// dropped, and the next sample becomes time zero.
+	while(eyetracker->nextSample()){}
+	time_origin = -1;
+	current_time = microseconds(0);
+}
+
+
+Point2D EyelinkHRT::sampleGazePosition(){
+	// Must be called with the mutex held (i.e., from within track())
+	Point2D screen_pos = eyetracker->getGazePosition();
+	if(!geometry.isConfigured()||(eyetracker->getUnits()!=GAZE_UNITS_PIXELS)){
+		return screen_pos;
+	}
+	Point2D ppd = geometry.usesSampleResolution()? eyetracker->getResolution():Point2D(0,0);
+	return geometry.toDegrees(screen_pos,ppd);
 }
 
+unsigned int EyelinkHRT::sampleFlags(){
+	unsigned int flags = 0;
+	if(current_blink){
+		flags |= GazeDatum::GAZE_BLINK;
+	}
+	if(!eyetracker->isSampleValid()){
+		flags |= GazeDatum::GAZE_INVALID;
+	}
+	return flags;
+}
+
+GazeDatum EyelinkHRT::acquireSample(){
+	// Must be called with the mutex held (i.e., from within track()). Samples
+	// are time-stamped by the tracker, so intervals are exact even if our polls
+	// are not.
+	current_pos = sampleGazePosition();
+	if(time_origin<0){
+		time_origin = eyetracker->getSampleTime();
+	}
+	current_time = microseconds(eyetracker->getSampleTime()-time_origin);
+	current_blink = eyetracker->getBlinkSignal();
+	return GazeDatum(current_pos,current_time.count(),sampleFlags());
+}
 
 void EyelinkHRT::startTracking(){
 	mutex.lock();
@@ -76,8 +124,8 @@ void EyelinkHRT::startTracking(){
 		gaze_data.clear();
 		blink_detected = false;
 		state = HRT_TRACKING;
-		start_time = hr_clock::now();
-		current_time = chrono::duration_cast<milliseconds>(hr_clock::now()-start_time);
+		restartClock();
+		state_cv.notify_all();
 	}
 	mutex.unlock();
 }
@@ -97,12 +145,19 @@ void EyelinkHRT::startRecording(){
 	}
 	mutex.lock();
 	//cout<<"\n...recording eye movements...\n"<<endl;
-	temporal_resolution = milliseconds(1);
+	// no need to reset temporal_resolution here: every queued sample is
+	// recorded regardless of how often the link is polled
 	state = HRT_RECORDING;
 	gaze_data.clear();
 	gaze_data.reserve(10000); //i.e., reserve enough space for 10 seconds
-	start_time = hr_clock::now();
-	current_time = chrono::duration_cast<milliseconds>(hr_clock::now()-start_time);
+	// start from a clean history so offline reanalysis of the recording
+	// (see GazeBatch) reproduces the online estimates exactly
+	kinematics.reset();
+	// units and threshold can't change until the recording stops (see
+	// setDisplayGeometry), so they describe all of the recorded samples
+	recording_units = usesDegrees()? GAZE_UNITS_DEGREES:GAZE_UNITS_PIXELS;
+	recording_threshold = kinematics.getSaccadeVelocityThreshold();
+	restartClock();
 	mutex.unlock();
 }
 
@@ -115,15 +170,21 @@ void EyelinkHRT::stopRecording(){
 	mutex.unlock();
 }
 
-void EyelinkHRT::setTemporalResolution(int ms){
+void EyelinkHRT::setTemporalResolution(double ms){
+	mutex.lock();
+	temporal_resolution = microseconds((int64_t) (1000.0*ms));
+	mutex.unlock();
+}
+
+void EyelinkHRT::setTrackingEye(int tracking_eye){
 	mutex.lock();
-	temporal_resolution = milliseconds(ms);
+	eyetracker->setTrackingEye(tracking_eye);
 	mutex.unlock();
 }
 
-unsigned int EyelinkHRT::getCurrentTime(){
+int64_t EyelinkHRT::getCurrentTime(){
 	mutex.lock();
-	unsigned int ctime = current_time.count();
+	int64_t ctime = current_time.count();
 	mutex.unlock();
 	return ctime;
 }
@@ -138,59 +199,245 @@ GazeDatum EyelinkHRT::getCurrentPos(){
 	
 }
 
-Point2D EyelinkHRT::getCurrentPos(unsigned int integration_time){
+Point2D EyelinkHRT::getCurrentPos(double integration_time){
 	// This version integrates position across the last 'integration time' ms
 	mutex.lock();
-	const unsigned int c_time = current_time.count();
+	const int64_t c_time = current_time.count();
 	mutex.unlock();
-	const unsigned int s_time = c_time-integration_time;
+	const int64_t s_time = c_time-(int64_t) (1000.0*integration_time);
 	vector<GazeDatum> data_copy = getGazeData();
 	Point2D position_sum(0,0);
 	int t = data_copy.size()-1;
 	int nr_timesteps = 0;
 	// integrate across positions from s_time to c_time
-	while(data_copy[t].time>=s_time){
+	while((t>=0)&&(data_copy[t].time>=s_time)){
 		position_sum = position_sum+data_copy[t].pos;
 		++nr_timesteps;
-		++t;
+		--t;
 	}
 	// return mean position
 	return position_sum/double(nr_timesteps);	
 }
 
-void EyelinkHRT::updateCurrentVelocity(){
-	Point2D new_velocity,avg_velocity;
-	GazeDatum current_gaze, previous_gaze;
-	current_gaze = short_gazelist[0];
-	previous_gaze = short_gazelist[1];
-	new_velocity = 1000.0*(current_gaze.pos-previous_gaze.pos)/double(current_gaze.time-previous_gaze.time);
-	//avg_velocity = 0.75*new_velocity+0.25*current_velocity;
-	current_velocity = new_velocity;//avg_velocity;
-}
-
 GazeDatum EyelinkHRT::getCurrentVelocity(){
 	GazeDatum velocity;
 	mutex.lock();
-	velocity = GazeDatum(current_velocity,current_time.count());
+	velocity = GazeDatum(kinematics.getVelocity(),current_time.count());
 	mutex.unlock();
 	return velocity;
 }
 
-void EyelinkHRT::updateCurrentVelocityAndAccel(){
-	Point2D v1,v2;
-	v1 = 1000.0*((short_gazelist[1].pos)-(short_gazelist[2].pos))/double(short_gazelist[1].time-short_gazelist[2].time);
-	v2 = 1000.0*((short_gazelist[0].pos)-(short_gazelist[1].pos))/double(short_gazelist[0].time-short_gazelist[1].time);
-	double t1,t2;
-	t1 = 0.5*(short_gazelist[1].time + short_gazelist[2].time);
-	t2 = 0.5*(short_gazelist[0].time + short_gazelist[1].time);
-	current_velocity = 0.75*v2+0.25*v1;
-	current_accel = 1000.0*(v2-v1)/(t2-t1);
+void EyelinkHRT::updateWaitCondition(){
+	// Called from track() (with the mutex held) after each new sample
+	const int64_t t = current_time.count();
+	const bool saccading = kinematics.isSaccading();
+	bool satisfied = false;
+	switch(wait_condition.type){
+		case GazeCondition::GAZE_IN_REGION:
+			if((current_pos.x>=wait_condition.region_min.x)&&(current_pos.x<=wait_condition.region_max.x)&&
+				(current_pos.y>=wait_condition.region_min.y)&&(current_pos.y<=wait_condition.region_max.y)){
+				if(region_entry_time<0){
+					region_entry_time = t;
+				}
+				satisfied = (t-region_entry_time>=wait_condition.duration);
+			}else{
+				region_entry_time = -1;
+			}
+			break;
+		case GazeCondition::VELOCITY_ABOVE:
+			satisfied = (kinematics.getVelocity().vlength()>wait_condition.threshold);
+			break;
+		case GazeCondition::SACCADE_ONSET:
+			satisfied = saccading&&!prev_saccading;
+			break;
+		case GazeCondition::BLINK_END:
+			satisfied = prev_blink&&!current_blink;
+			break;
+	}
+	prev_saccading = saccading;
+	prev_blink = current_blink;
+	if(satisfied){
+		wait_time = t;
+		wait_satisfied = true;
+		wait_pending = false;
+		wait_cv.notify_all();
+	}
+}
+
+// A day; much longer timeouts would overflow the clock's (nanosecond) time_point
+const double EyelinkHRT::MAX_WAIT_TIMEOUT_MS = 24*3600*1000.0;
+
+bool EyelinkHRT::waitFor(const GazeCondition &condition, double timeout_ms, int64_t &event_time){
+	const bool timed = (timeout_ms>=0.0)&&(timeout_ms<=MAX_WAIT_TIMEOUT_MS); // false for NaN
+	hr_clock::time_point deadline = hr_clock::now();
+	if(timed){
+		deadline += microseconds((int64_t) (1000.0*timeout_ms));
+	}
+	stdx::unique_lock<stdx::mutex> lock(mutex);
+	wait_condition = condition;
+	wait_satisfied = false;
+	region_entry_time = -1;
+	// transitions are measured relative to the state when the wait began
+	prev_saccading = kinematics.isSaccading();
+	prev_blink = current_blink;
+	wait_pending = true;
+	while(!wait_satisfied){
+		if(!timed){
+			wait_cv.wait(lock);
+		}else if(wait_cv.wait_until(lock,deadline)==stdx::cv_status::timeout){
+			break;
+		}
+	}
+	wait_pending = false;
+	if(wait_satisfied){
+		event_time = wait_time;
+	}
+	return wait_satisfied;
+}
+
+bool EyelinkHRT::setSaccadeVelocityThreshold(double threshold){
+	// an explicit threshold (in the current position units/sec) overrides the
+	// default that comes with a display geometry
+	mutex.lock();
+	bool ok = (state!=HRT_RECORDING);
+	if(ok){
+		explicit_saccade_threshold = true;
+		kinematics.setSaccadeVelocityThreshold(threshold);
+	}
+	mutex.unlock();
+	return ok;
+}
+
+double EyelinkHRT::getSaccadeVelocityThreshold(){
+	mutex.lock();
+	double threshold = kinematics.getSaccadeVelocityThreshold();
+	mutex.unlock();
+	return threshold;
+}
+
+bool EyelinkHRT::isSaccading(){
+	mutex.lock();
+	bool saccading = kinematics.isSaccading();
+	mutex.unlock();
+	return saccading;
+}
+
+bool EyelinkHRT::setDisplayGeometry(double width_mm, double height_mm, int res_x, int res_y,
+	double distance_mm, bool use_sample_resolution){
+	// build the new lookup tables before taking the lock
+	DisplayGeometry new_geometry;
+	new_geometry.configure(width_mm,height_mm,res_x,res_y,distance_mm,use_sample_resolution);
+	mutex.lock();
+	bool ok = (state!=HRT_RECORDING);
+	if(ok){
+		geometry = new_geometry;
+		changeUnits();
+	}
+	mutex.unlock();
+	return ok;
+}
+
+bool EyelinkHRT::clearDisplayGeometry(){
+	mutex.lock();
+	bool ok = (state!=HRT_RECORDING);
+	if(ok){
+		geometry.clear();
+		changeUnits();
+	}
+	mutex.unlock();
+	return ok;
+}
+
+void EyelinkHRT::changeUnits(){
+	// Must be called with the mutex held. Estimates in the old units are
+	// discarded, and the default saccade threshold (which is in deg/sec) only
+	// applies to angular positions.
+	if(!explicit_saccade_threshold){
+		kinematics.setSaccadeVelocityThreshold(usesDegrees()? GazeKinematics::DEFAULT_SACCADE_THRESHOLD:0.0);
+	}
+	kinematics.reset();
+	quality.reset();
+}
+
+bool EyelinkHRT::usesDegrees() const{
+	// Must be called with the mutex held
+	return geometry.isConfigured()||(eyetracker->getUnits()==GAZE_UNITS_DEGREES);
+}
+
+void EyelinkHRT::updateQuality(const GazeDatum &gd){
+	// Called from track() (with the mutex held) for each new tracker sample;
+	// fixations can only be told apart once saccades are being classified.
+	// The window spans trials, so it is fed the source's own clock rather than
+	// gd.time, which restartClock() sets back to zero on every 'start'.
+	const bool fixating = kinematics.classifiesSaccades()&&!kinematics.isSaccading();
+	quality.addSample(gd.pos,eyetracker->getSampleTime(),gd.flags==0,fixating);
+}
+
+void EyelinkHRT::setQualityWindow(size_t window_size){
+	GazeQuality new_quality(window_size);
+	mutex.lock();
+	quality = new_quality;
+	mutex.unlock();
+}
+
+GazeQualityMetrics EyelinkHRT::getQualityMetrics(){
+	mutex.lock();
+	GazeQualityMetrics metrics = quality.getMetrics();
+	mutex.unlock();
+	return metrics;
+}
+
+void EyelinkHRT::flushHeatmap(){
+	// Called from track() (with the mutex held) once enough samples are
+	// pending. If a reader holds the histogram, the sampler doesn't wait for
+	// it; the samples stay pending and the flush is retried on the next one.
+	if(heatmap_mutex.try_lock()){
+		heatmap.takePending(heatmap_bins);
+		heatmap.accumulate(heatmap_bins);
+		heatmap_mutex.unlock();
+	}
+}
+
+void EyelinkHRT::configureHeatmap(int nx, int ny, double xmin, double xmax, double ymin, double ymax,
+	double sigma, bool duration_weighting){
+	// set up the new grid and kernel before taking the locks
+	GazeHeatmap new_heatmap;
+	new_heatmap.configure(nx,ny,xmin,xmax,ymin,ymax,sigma,duration_weighting);
+	heatmap_mutex.lock();
+	mutex.lock();
+	heatmap = new_heatmap;
+	mutex.unlock();
+	heatmap_mutex.unlock();
+}
+
+void EyelinkHRT::resetHeatmap(){
+	heatmap_mutex.lock();
+	mutex.lock();
+	heatmap.reset();
+	mutex.unlock();
+	heatmap_mutex.unlock();
+}
+
+vector<double> EyelinkHRT::getHeatmap(int &nx, int &ny){
+	// Only the pending-sample log is swapped out under the sampler's lock;
+	// adding it to the histogram and smoothing happen outside of it.
+	vector<double> map;
+	heatmap_mutex.lock();
+	mutex.lock();
+	heatmap.takePending(heatmap_bins);
+	mutex.unlock();
+	heatmap.accumulate(heatmap_bins);
+	heatmap.getMap(map);
+	nx = heatmap.getNx();
+	ny = heatmap.getNy();
+	heatmap_mutex.unlock();
+	return map;
 }
 
 Point2D EyelinkHRT::getCurrentAcceleration(){
 	Point2D accel;
 	mutex.lock();
-	accel = current_accel;
+	accel = kinematics.getAcceleration();
 	mutex.unlock();
 	return accel;
 }
@@ -203,6 +450,24 @@ vector<GazeDatum> EyelinkHRT::getGazeData(){
 	return data_copy;
 }
 
+GazeCodec EyelinkHRT::getCodec(){
+	// Uses the settings in effect when the recording started. Angular positions
+	// need a finer quantization step than pixel positions.
+	mutex.lock();
+	GazeUnits units = recording_units;
+	double threshold = recording_threshold;
+	mutex.unlock();
+	GazeCodec codec((units==GAZE_UNITS_DEGREES)? 0.001:0.01);
+	codec.setRecordingSettings(units,threshold);
+	return codec;
+}
+
+bool EyelinkHRT::saveGazeData(const std::string &filename){
+	// encode outside of the lock so that the sampling thread isn't held up
+	vector<GazeDatum> data_copy = getGazeData();
+	return getCodec().save(filename,data_copy);
+}
+
 bool EyelinkHRT::checkForBlink(){
 	mutex.lock();
 	bool temp_bool = blink_detected;
@@ -224,8 +489,8 @@ void EyelinkHRT::setBlinkDetected(bool b){
 }
 ///////////////////////////////////////
 
-int EyelinkHRT::getFinalTime(){
-	int final_time;
+int64_t EyelinkHRT::getFinalTime(){
+	int64_t final_time;
 	mutex.lock();
 	final_time = gaze_data[gaze_data.size()-1].time;
 	mutex.unlock();
@@ -236,20 +501,34 @@ stdx::mutex* EyelinkHRT::getMutexPtr(){
 	return &mutex;
 }
 
-EyelinkHRT *EyelinkHRT::getInstance(LiteTracker *tracker){
-	if(unique_instance == NULL){
-		unique_instance = new EyelinkHRT(tracker);
-	}
-	return unique_instance;
-}
-
-EyelinkHRT::EyelinkHRT(LiteTracker *tracker_ptr){
+EyelinkHRT::EyelinkHRT(GazeSource *source):
+	eyetracker(source),
+	state(HRT_STOPPED),
+	hrtThread(NULL),
+	MAX_TRACK_TIME(chrono::seconds(60)),
+	temporal_resolution(milliseconds(1)),
+	blink_detected(false),
+	time_origin(-1),
+	current_time(0),
+	current_pos(0,0),
+	current_blink_voltage(0),
+	thread_alive(true),
+	current_blink(false),
+	wait_pending(false),
+	wait_satisfied(false),
+	wait_time(0),
+	region_entry_time(-1),
+	prev_saccading(false),
+	prev_blink(false),
+	explicit_saccade_threshold(false),
+	recording_units(GAZE_UNITS_PIXELS),
+	recording_threshold(0.0)
+{
 	printf("\n...constructing High Res Tracker...\n");
-	eyetracker = tracker_ptr;
-	thread_alive = true;
+	changeUnits(); // e.g., replayed files may already hold angular positions
+	// start the sampling thread only once all of the state above is set up
 	//hrtThreadPtr = stdx::shared_ptr<stdx::thread>(new stdx::thread(&EyelinkHRT::track));
-	hrtThread = new stdx::thread(&EyelinkHRT::track);
-	state = HRT_STOPPED;
+	hrtThread = new stdx::thread(&EyelinkHRT::track,this);
 }
 
 EyelinkHRT::~EyelinkHRT(){
@@ -257,26 +536,10 @@ EyelinkHRT::~EyelinkHRT(){
 	printf("\n...deleting HRT thread object...\n");
 	mutex.lock();
 	thread_alive = false;
+	state_cv.notify_all();
 	mutex.unlock();
 	if(hrtThread->joinable()){
 		hrtThread->join();
 	}
 	delete hrtThread;
 }
-
-EyelinkHRT* EyelinkHRT::unique_instance = NULL;
-vector<GazeDatum> EyelinkHRT::gaze_data;
-vector<GazeDatum> EyelinkHRT::short_gazelist(3);
-hr_clock::time_point EyelinkHRT::start_time;
-milliseconds EyelinkHRT::current_time;
-milliseconds EyelinkHRT::MAX_TRACK_TIME = chrono::seconds(60);
-milliseconds EyelinkHRT::temporal_resolution = milliseconds(1);
-Point2D EyelinkHRT::current_pos(0,0);
-Point2D EyelinkHRT::current_velocity(0,0);
-Point2D EyelinkHRT::current_accel(0,0);
-bool EyelinkHRT::blink_detected = false;
-EyelinkHRT::HRTState EyelinkHRT::state = HRT_STOPPED;
-stdx::thread *EyelinkHRT::hrtThread = NULL;
-stdx::mutex EyelinkHRT::mutex;
-LiteTracker *EyelinkHRT::eyetracker = NULL;
-bool EyelinkHRT::thread_alive = true;
\ No newline at end of file
@@ -9,12 +9,18 @@
 #include <sstream>
 #include <vector>
 #include "GazeDatum.h"
-#include "LiteTracker.h"
+#include "GazeCodec.h"
+#include "DisplayGeometry.h"
+#include "GazeHeatmap.h"
+#include "GazeQuality.h"
+#include "GazeKinematics.h"
+#include "GazeSource.h"
 
 #if (__cplusplus > 199711L)
 	#include <chrono>
 	#include <thread>
 	#include <mutex>
+	#include <condition_variable>
 	namespace stdx = std;
 #else
 // Import boost libraries (unnecessary if compiling under C++11 or later)
@@ -27,76 +33,142 @@
 
 // To Do: Add a state that allows for temporal integration when not recording.
 
+// A gaze event that a caller can block on via EyelinkHRT::waitFor()
+struct GazeCondition{
+	enum Type{
+		GAZE_IN_REGION,		// gaze within [region_min,region_max] for 'duration'
+		VELOCITY_ABOVE,		// gaze speed exceeds 'threshold'
+		SACCADE_ONSET,		// transition into the saccading state
+		BLINK_END		// transition out of a blink
+	};
+	Type type;
+	Point2D region_min;
+	Point2D region_max;
+	int64_t duration;	// in microseconds
+	double threshold;	// in deg/sec (or pixels/sec without a display geometry)
+	GazeCondition(Type type=SACCADE_ONSET): type(type), duration(0), threshold(0){}
+};
+
 class EyelinkHRT{
 	enum HRTState{
 		HRT_STOPPED,
 		HRT_TRACKING,
 		HRT_RECORDING
 	};
-	enum SaccadeState{
-		HRT_FIXATING,
-		HRT_SACCADING
-	};
 private:
 	// Private Variables
-	static EyelinkHRT *unique_instance;
-	static LiteTracker *eyetracker; 
-	static HRTState state;
-	static SaccadeState saccade_state;
-	static stdx::thread *hrtThread;
-	static stdx::mutex mutex;
-	static stdx::chrono::milliseconds MAX_TRACK_TIME;
-	static stdx::chrono::milliseconds temporal_resolution;
-	static bool blink_detected;
-	static stdx::chrono::high_resolution_clock::time_point start_time;
-	static stdx::chrono::milliseconds current_time;
-	static Point2D current_pos;
-	static Point2D current_velocity;
-	static Point2D current_accel;
-	static double current_blink_voltage;
-	static std::vector<GazeDatum> gaze_data;
-	static bool thread_alive;
-	static std::vector<GazeDatum> short_gazelist;
-	static double saccade_velocity_threshold;
+	GazeSource *eyetracker; 
+	HRTState state;
+	stdx::thread *hrtThread;
+	stdx::mutex mutex;
+	stdx::condition_variable state_cv; // wakes the sampling thread when tracking starts
+	stdx::chrono::microseconds MAX_TRACK_TIME;
+	stdx::chrono::microseconds temporal_resolution;
+	bool blink_detected;
+	int64_t time_origin;	// tracker time (us) of the first sample; -1 until it arrives
+	stdx::chrono::microseconds current_time;
+	Point2D current_pos;
+	double current_blink_voltage;
+	std::vector<GazeDatum> gaze_data;
+	bool thread_alive;
+	GazeKinematics kinematics; // velocity, acceleration and saccade state
+	DisplayGeometry geometry;
+	GazeHeatmap heatmap;
+	// Guards the heatmap's histogram (see GazeHeatmap.h); always taken before
+	// 'mutex', and only ever try-locked by the sampling thread
+	stdx::mutex heatmap_mutex;
+	std::vector<GazeHeatmap::Bin> heatmap_bins; // flushed samples (guarded by heatmap_mutex)
+	GazeQuality quality;
+	bool current_blink;
+	// state for a pending waitFor() call
+	stdx::condition_variable wait_cv;
+	bool wait_pending;
+	bool wait_satisfied;
+	GazeCondition wait_condition;
+	int64_t wait_time;		// sample time at which the condition became true
+	int64_t region_entry_time;	// -1 while gaze is outside the region
+	bool prev_saccading;
+	bool prev_blink;
+	bool explicit_saccade_threshold;	// set via setSaccadeVelocityThreshold()
+	// settings in effect for the current (or last) recording
+	GazeUnits recording_units;
+	double recording_threshold;
 
 	// Private Methods
-	static void updateCurrentVelocity();
-	static void updateCurrentVelocityAndAccel();
-	static void updateSaccadeState();
-	EyelinkHRT(LiteTracker *tracker);
+	void processSample();
+	void restartClock();
+	void changeUnits();
+	bool usesDegrees() const;
+	void updateWaitCondition();
+	void updateQuality(const GazeDatum &gd);
+	void flushHeatmap();
+	Point2D sampleGazePosition();
+	unsigned int sampleFlags();
+	GazeDatum acquireSample();
+	GazeCodec getCodec();
 
 public:
 
 	// Public Methods
-	static void track();
-	static void startTracking();
-	static void stopTracking();
-	static void startRecording();
-	static void stopRecording();
-	static void setTemporalResolution(int ms);
-	static GazeDatum getCurrentPos();
-	static unsigned int getCurrentTime();
-	static Point2D getCurrentPos(unsigned int ms);
-	static Point2D getCurrentAcceleration();// in deg/sec^2
-	static GazeDatum getCurrentVelocity(); // in deg/sec
-	static bool checkForBlink();
-	static void resetBlinkDetector();
-	static std::vector<GazeDatum> getGazeData();
+	// Each instance owns its own sampling thread, buffers and configuration,
+	// so several trackers (e.g., one per eye, or a live and a replayed one)
+	// can run side by side. The thread sleeps while tracking is stopped.
+	EyelinkHRT(GazeSource *source);
+	void track();
+	void startTracking();
+	void stopTracking();
+	void startRecording();
+	void stopRecording();
+	void setTemporalResolution(double ms);
+	void setTrackingEye(int tracking_eye);
+	GazeDatum getCurrentPos();
+	int64_t getCurrentTime(); // in microseconds
+	Point2D getCurrentPos(double ms);
+	Point2D getCurrentAcceleration();// in deg/sec^2
+	GazeDatum getCurrentVelocity(); // in deg/sec
+	// Positions (and hence velocities and accelerations) are reported in
+	// degrees of visual angle once a display geometry has been set, and in
+	// screen pixels otherwise. Neither the geometry nor the saccade threshold
+	// can be changed during a recording (these return false).
+	bool setDisplayGeometry(double width_mm, double height_mm, int res_x, int res_y,
+		double distance_mm, bool use_sample_resolution=false);
+	bool clearDisplayGeometry();
+	// In position units/sec (<=0 turns saccade classification off). Without an
+	// explicit threshold, saccades are classified at 30 deg/sec once a display
+	// geometry is set, and not at all in pixel coordinates.
+	bool setSaccadeVelocityThreshold(double threshold);
+	double getSaccadeVelocityThreshold();
+	// Optional gaze density map, accumulated for every tracked or recorded sample
+	void configureHeatmap(int nx, int ny, double xmin, double xmax, double ymin, double ymax,
+		double sigma=0.0, bool duration_weighting=false);
+	void resetHeatmap();
+	std::vector<double> getHeatmap(int &nx, int &ny); // smoothed, column-major ny x nx
+	// Rolling data-quality metrics over the last 'window_size' tracker samples
+	void setQualityWindow(size_t window_size);
+	GazeQualityMetrics getQualityMetrics();
+	bool isSaccading();
+	bool checkForBlink();
+	// Blocks until 'condition' holds for a sample taken after the call (or until
+	// 'timeout_ms' elapses). Returns true and sets 'event_time' (us) on success.
+	// Timeouts that are negative, infinite or longer than MAX_WAIT_TIMEOUT_MS
+	// (or NaN) mean no timeout.
+	static const double MAX_WAIT_TIMEOUT_MS;
+	bool waitFor(const GazeCondition &condition, double timeout_ms, int64_t &event_time);
+	void resetBlinkDetector();
+	std::vector<GazeDatum> getGazeData();
+	bool saveGazeData(const std::string &filename);
 	//For testing purposes only:
-	static void setBlinkDetected(bool b);
-	static stdx::mutex* getMutexPtr();
+	void setBlinkDetected(bool b);
+	stdx::mutex* getMutexPtr();
 	//////////////////////////////////
 
-	int getFinalTime();
+	int64_t getFinalTime();
 
 	friend std::ofstream &operator<<(std::ofstream &fs, EyelinkHRT &hrt){
-		std::vector<GazeDatum> local_gaze_data = hrt.getGazeData();
-		int arraysize = local_gaze_data.size();//*sizeof(GazeDatum);
-		GazeDatum* dataPtr = &local_gaze_data[0];
-		// Print out (in binary format) the length of the data vector
-		// followed by the vector itself
-		fs.write(reinterpret_cast<char*>(&arraysize),sizeof(int));
-		fs.write(reinterpret_cast<char*>(dataPtr),arraysize*sizeof(GazeDatum));
+		// Write out the gaze data in the compressed block format (see GazeCodec.h)
+		std::vector<unsigned char> buffer;
+		hrt.getCodec().encode(hrt.getGazeData(),buffer);
+		fs.write(reinterpret_cast<char*>(&buffer[0]),buffer.size());
 		return fs;
 	}
 
@@ -113,6 +185,5 @@ public:
 		oss.flush();
 		return oss;
 	}
-	static EyelinkHRT *getInstance(LiteTracker *tracker);
 	~EyelinkHRT();
 };
\ No newline at end of file
@@ -0,0 +1,245 @@
+// GazeBatch.cpp
+#include <cstdio>
+#include <cerrno>
+#include "GazeBatch.h"
+#include "GazeCodec.h"
+#include "MappedFile.h"
+#include "TaskPool.h"
+
+#if (__cplusplus > 199711L)
+	#include <chrono>
+	#include <atomic>
+	namespace chrono = std::chrono;
+#else
+// Import boost libraries (unnecessary if compiling under C++11 or later)
+	#include <boost/chrono.hpp>
+	#include <boost/atomic.hpp>
+	namespace chrono = boost::chrono;
+#endif
+
+#ifdef _WIN32
+	#include <direct.h>
+	#define MAKE_DIR(path) _mkdir(path)
+#else
+	#include <sys/stat.h>
+	#define MAKE_DIR(path) mkdir(path,0777)
+#endif
+
+using std::string;
+using std::vector;
+typedef chrono::steady_clock hr_clock;
+
+static const char *EVENT_NAMES[] = {"saccade","blink"};
+
+static bool writeFile(const string &filename, const string &contents){
+	FILE *fp = fopen(filename.c_str(),"wb");
+	if(fp==NULL){
+		return false;
+	}
+	bool ok = (fwrite(contents.data(),1,contents.size(),fp)==contents.size());
+	return (fclose(fp)==0)&&ok;
+}
+
+// Creates 'path' along with any missing parent directories (like mkdir -p)
+static bool makeDirectories(const string &path){
+	for(size_t pos=path.find_first_of("/\\",1);;pos=path.find_first_of("/\\",pos+1)){
+		string dir = path.substr(0,pos);
+		if(!dir.empty()&&(dir[dir.size()-1]!=':')&&(MAKE_DIR(dir.c_str())!=0)&&(errno!=EEXIST)){
+			return false;
+		}
+		if(pos==string::npos){
+			return true;
+		}
+	}
+}
+
+
+///////////////////////////////////////////////////////
+////////// Method Definitions /////////////////////////
+const double GazeBatch::RECORDED_THRESHOLD = -1.0;
+
+GazeBatch::GazeBatch(double saccade_velocity_threshold):
+	saccade_velocity_threshold(saccade_velocity_threshold), write_kinematics(true){}
+
+double GazeBatch::thresholdFor(const GazeArchive &archive) const{
+	if(saccade_velocity_threshold>=0){
+		return saccade_velocity_threshold;
+	}
+	if(archive.getUnits()!=GAZE_UNITS_UNKNOWN){
+		return archive.getSaccadeVelocityThreshold(); // 0 if saccades weren't classified
+	}
+	// Files written before version 3 don't record their settings; positions
+	// were stored to 0.001 deg with a display geometry and 0.01 px without.
+	// Only the former has a meaningful default threshold.
+	return (archive.getResolution()<0.005)? GazeKinematics::DEFAULT_SACCADE_THRESHOLD:0.0;
+}
+
+string GazeBatch::outputPath(const string &filename, const string &suffix) const{
+	// <output_dir>/<input name without extension><suffix>
+	size_t slash = filename.find_last_of("/\\");
+	size_t name_start = (slash==string::npos)? 0:slash+1;
+	size_t dot = filename.find_last_of('.');
+	size_t name_end = ((dot==string::npos)||(dot<name_start))? filename.size():dot;
+	if(output_dir.empty()){
+		return filename.substr(0,name_end)+suffix;
+	}
+	string dir = output_dir;
+	if((dir[dir.size()-1]!='/')&&(dir[dir.size()-1]!='\\')){
+		dir += '/';
+	}
+	return dir+filename.substr(name_start,name_end-name_start)+suffix;
+}
+
+void GazeBatch::analyzeTrial(const vector<GazeDatum> &data, double saccade_velocity_threshold,
+	vector<GazeEvent> &events, string *kinematics) const{
+	GazeKinematics tracker(saccade_velocity_threshold);
+	GazeEvent saccade, blink;
+	bool in_saccade = false, in_blink = false;
+	char row[256];
+	if(kinematics!=NULL){
+		kinematics->append("t,x,y,vx,vy,speed,ax,ay,saccade,blink,flags\n");
+		kinematics->reserve(kinematics->size()+96*data.size());
+	}
+	for(size_t i=0;i<data.size();++i){
+		const GazeDatum &gd = data[i];
+		const Point2D prev_pos = (i>0)? data[i-1].pos:gd.pos;
+		tracker.addSample(gd);
+		Point2D velocity = tracker.getVelocity();
+		const double speed = velocity.vlength();
+		// saccades
+		if(tracker.isSaccading()){
+			if(!in_saccade){
+				in_saccade = true;
+				saccade.type = GazeEvent::SACCADE;
+				saccade.start_time = gd.time;
+				saccade.start_pos = prev_pos;
+				saccade.peak_velocity = 0.0;
+			}
+			if(speed>saccade.peak_velocity){
+				saccade.peak_velocity = speed;
+			}
+		}else if(in_saccade){
+			in_saccade = false;
+			saccade.end_time = gd.time;
+			saccade.end_pos = gd.pos;
+			events.push_back(saccade);
+		}
+		// blinks
+		if(tracker.isBlinking()){
+			if(!in_blink){
+				in_blink = true;
+				blink.type = GazeEvent::BLINK;
+				blink.start_time = gd.time;
+				blink.start_pos = prev_pos;
+				blink.peak_velocity = 0.0;
+			}
+		}else if(in_blink){
+			in_blink = false;
+			blink.end_time = gd.time;
+			blink.end_pos = gd.pos;
+			events.push_back(blink);
+		}
+		if(kinematics!=NULL){
+			Point2D accel = tracker.getAcceleration();
+			int n = snprintf(row,sizeof(row),"%.6f,%.4f,%.4f,%.3f,%.3f,%.3f,%.1f,%.1f,%d,%d,%u\n",
+				gd.time*1.0e-6,gd.pos.x,gd.pos.y,velocity.x,velocity.y,speed,accel.x,accel.y,
+				(int) tracker.isSaccading(),(int) tracker.isBlinking(),gd.flags);
+			kinematics->append(row,(n<(int) sizeof(row))? n:sizeof(row)-1);
+		}
+	}
+	// close any event still in progress at the end of the trial
+	if(!data.empty()){
+		if(in_saccade){
+			saccade.end_time = data.back().time;
+			saccade.end_pos = data.back().pos;
+			events.push_back(saccade);
+		}
+		if(in_blink){
+			blink.end_time = data.back().time;
+			blink.end_pos = data.back().pos;
+			events.push_back(blink);
+		}
+	}
+}
+
+bool GazeBatch::processFile(const string &filename, uint64_t &nr_samples) const{
+	nr_samples = 0;
+	MappedFile file;
+	GazeArchive archive;
+	if(!file.open(filename)||!archive.attach(file.getData(),file.size())){
+		fprintf(stderr,"...unable to read %s...\n",filename.c_str());
+		return false;
+	}
+	vector<GazeDatum> data;
+	if(!archive.decodeAll(data)){
+		fprintf(stderr,"...%s is corrupt...\n",filename.c_str());
+		return false;
+	}
+	vector<GazeEvent> events;
+	string kinematics;
+	analyzeTrial(data,thresholdFor(archive),events,write_kinematics? &kinematics:NULL);
+
+	string event_table = "type,start,end,duration,start_x,start_y,end_x,end_y,amplitude,peak_velocity\n";
+	char row[256];
+	for(size_t i=0;i<events.size();++i){
+		const GazeEvent &ev = events[i];
+		int n = snprintf(row,sizeof(row),"%s,%.6f,%.6f,%.6f,%.4f,%.4f,%.4f,%.4f,%.4f,%.3f\n",
+			EVENT_NAMES[ev.type],ev.start_time*1.0e-6,ev.end_time*1.0e-6,(ev.end_time-ev.start_time)*1.0e-6,
+			ev.start_pos.x,ev.start_pos.y,ev.end_pos.x,ev.end_pos.y,(ev.end_pos-ev.start_pos).vlength(),
+			ev.peak_velocity);
+		event_table.append(row,(n<(int) sizeof(row))? n:sizeof(row)-1);
+	}
+	bool ok = writeFile(outputPath(filename,"_events.csv"),event_table);
+	if(write_kinematics){
+		ok = writeFile(outputPath(filename,"_kinematics.csv"),kinematics)&&ok;
+	}
+	if(!ok){
+		fprintf(stderr,"...unable to write results for %s...\n",filename.c_str());
+		return false;
+	}
+	nr_samples = data.size();
+	return true;
+}
+
+// Processes one file per task item and tallies the results
+class GazeBatchTask: public TaskPool::Task{
+	const GazeBatch &batch;
+	const vector<string> &filenames;
+public:
+	stdx::atomic<uint64_t> nr_samples;
+	stdx::atomic<size_t> nr_failed;
+	GazeBatchTask(const GazeBatch &batch, const vector<string> &filenames):
+		batch(batch), filenames(filenames), nr_samples(0), nr_failed(0){}
+	void run(size_t item){
+		uint64_t n;
+		if(batch.processFile(filenames[item],n)){
+			nr_samples += n;
+		}else{
+			++nr_failed;
+		}
+	}
+};
+
+GazeBatchStats GazeBatch::run(const vector<string> &filenames, unsigned int nr_threads) const{
+	GazeBatchStats stats;
+	stats.nr_files = filenames.size();
+	if(!output_dir.empty()&&!makeDirectories(output_dir)){
+		fprintf(stderr,"...unable to create output directory %s...\n",output_dir.c_str());
+		stats.nr_failed = filenames.size();
+		stats.nr_samples = 0;
+		stats.elapsed_time = 0.0;
+		stats.samples_per_sec = 0.0;
+		return stats;
+	}
+	TaskPool pool(nr_threads);
+	GazeBatchTask task(*this,filenames);
+	hr_clock::time_point start = hr_clock::now();
+	pool.run(task,filenames.size());
+	chrono::duration<double> elapsed = hr_clock::now()-start;
+
+	stats.nr_failed = task.nr_failed;
+	stats.nr_samples = task.nr_samples;
+	stats.elapsed_time = elapsed.count();
+	stats.samples_per_sec = (stats.elapsed_time>0)? stats.nr_samples/stats.elapsed_time:0.0;
+	return stats;
+}
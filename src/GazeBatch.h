@@ -0,0 +1,58 @@
+// GazeBatch.h
+// Offline (re)analysis of recorded session files (as written by
+// eyelink_hrt('save',...)). Each file is one trial; files are memory-mapped and
+// processed in parallel on a work-stealing thread pool. Kinematics, saccades
+// and blinks are computed with the same GazeKinematics code used online.
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "GazeDatum.h"
+#include "GazeCodec.h"
+#include "GazeKinematics.h"
+
+struct GazeEvent{
+	enum Type{
+		SACCADE,
+		BLINK
+	};
+	Type type;
+	int64_t start_time;	// in microseconds
+	int64_t end_time;
+	Point2D start_pos;	// last sample before the event
+	Point2D end_pos;	// first sample after the event
+	double peak_velocity;
+};
+
+struct GazeBatchStats{
+	size_t nr_files;
+	size_t nr_failed;
+	uint64_t nr_samples;
+	double elapsed_time;	// in seconds
+	double samples_per_sec;
+};
+
+class GazeBatch{
+	double saccade_velocity_threshold;	// <0: use each file's recorded threshold
+	std::string output_dir;		// empty = next to each input file
+	bool write_kinematics;
+	std::string outputPath(const std::string &filename, const std::string &suffix) const;
+public:
+	static const double RECORDED_THRESHOLD;
+	// By default, each file is analyzed with the saccade threshold that was in
+	// effect when it was recorded (see thresholdFor()); a threshold >=0
+	// overrides that for every file (0 turns saccade classification off).
+	GazeBatch(double saccade_velocity_threshold=RECORDED_THRESHOLD);
+	void setOutputDirectory(const std::string &dir){output_dir = dir;}
+	void setWriteKinematics(bool write){write_kinematics = write;}
+	// Saccade threshold (in the file's position units/sec) used for 'archive'
+	double thresholdFor(const GazeArchive &archive) const;
+	// Runs the online detection pipeline over one trial. If 'kinematics' is
+	// non-NULL, a CSV row is appended to it for every sample.
+	void analyzeTrial(const std::vector<GazeDatum> &data, double saccade_velocity_threshold,
+		std::vector<GazeEvent> &events, std::string *kinematics) const;
+	// Decodes, analyzes and writes the results for a single session file
+	bool processFile(const std::string &filename, uint64_t &nr_samples) const;
+	// Creates the output directory (if needed) and processes every file
+	GazeBatchStats run(const std::vector<std::string> &filenames, unsigned int nr_threads=0) const;
+};
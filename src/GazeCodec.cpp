@@ -0,0 +1,394 @@
+// GazeCodec.cpp
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <utility>
+#include "GazeCodec.h"
+
+using std::vector;
+using std::string;
+
+static const char MAGIC[4] = {'E','H','R','T'};
+static const size_t HEADER_SIZE_V2 = 4+4+4+8+4+8+4+8;	// versions 1 and 2
+static const size_t HEADER_SIZE = HEADER_SIZE_V2+4+8;	// adds units, saccade threshold
+static const size_t INDEX_OFFSET_POS = 36;
+static const size_t INDEX_ENTRY_SIZE = 8+8+4;
+
+/// Utility functions
+// fixed-width little-endian fields
+static void putFixed(vector<unsigned char> &out, uint64_t v, int nbytes){
+	for(int i=0;i<nbytes;++i){
+		out.push_back((unsigned char)(v>>(8*i)));
+	}
+}
+
+static void setFixed(unsigned char *dst, uint64_t v, int nbytes){
+	for(int i=0;i<nbytes;++i){
+		dst[i] = (unsigned char)(v>>(8*i));
+	}
+}
+
+static uint64_t getFixed(const unsigned char *src, int nbytes){
+	uint64_t v = 0;
+	for(int i=0;i<nbytes;++i){
+		v |= uint64_t(src[i])<<(8*i);
+	}
+	return v;
+}
+
+static uint64_t doubleBits(double d){
+	uint64_t bits;
+	memcpy(&bits,&d,sizeof(bits));
+	return bits;
+}
+
+static double bitsDouble(uint64_t bits){
+	double d;
+	memcpy(&d,&bits,sizeof(d));
+	return d;
+}
+
+// zigzag varints
+static inline void putVarint(vector<unsigned char> &out, int64_t v){
+	uint64_t u = (uint64_t(v)<<1)^uint64_t(v>>63);
+	while(u>=0x80){
+		out.push_back((unsigned char)(u|0x80));
+		u >>= 7;
+	}
+	out.push_back((unsigned char)u);
+}
+
+// Reads a varint from [p,end); returns false if the buffer ends mid-varint or
+// the encoding is longer than any 64-bit value needs (i.e., corrupt data).
+static inline bool getVarint(const unsigned char *&p, const unsigned char *end, int64_t &v){
+	uint64_t u = 0;
+	int shift = 0;
+	unsigned char byte;
+	do{
+		if((p>=end)||(shift>63)){
+			return false;
+		}
+		byte = *p++;
+		u |= uint64_t(byte&0x7f)<<shift;
+		shift += 7;
+	}while(byte&0x80);
+	v = int64_t(u>>1)^-int64_t(u&1);
+	return true;
+}
+
+static inline int64_t quantize(double x, double scale){
+	if(x!=x){ // NaN
+		return 0;
+	}
+	return (int64_t) floor(x*scale+0.5);
+}
+
+
+///////////////////////////////////////////////////////
+////////// GazeCodec Method Definitions ///////////////
+const uint32_t GazeCodec::FORMAT_VERSION;
+const uint32_t GazeCodec::TICKS_PER_SECOND;
+const uint32_t GazeCodec::DEFAULT_BLOCK_SIZE;
+
+GazeCodec::GazeCodec(double resolution, uint32_t block_size): units(GAZE_UNITS_UNKNOWN),
+	saccade_velocity_threshold(0.0){
+	this->position_scale = 1.0/resolution;
+	this->block_size = (block_size>0)? block_size:DEFAULT_BLOCK_SIZE;
+}
+
+void GazeCodec::setRecordingSettings(GazeUnits units, double saccade_velocity_threshold){
+	this->units = units;
+	this->saccade_velocity_threshold = saccade_velocity_threshold;
+}
+
+void GazeCodec::encodeBlock(const GazeDatum *block, size_t n, vector<unsigned char> &out) const{
+	int64_t prev_t = block[0].time;
+	int64_t prev_x = quantize(block[0].pos.x,position_scale);
+	int64_t prev_y = quantize(block[0].pos.y,position_scale);
+	int64_t prev_dt = 0;
+	putVarint(out,prev_t);
+	putVarint(out,prev_x);
+	putVarint(out,prev_y);
+	for(size_t i=1;i<n;++i){
+		int64_t t = block[i].time;
+		int64_t x = quantize(block[i].pos.x,position_scale);
+		int64_t y = quantize(block[i].pos.y,position_scale);
+		int64_t dt = t-prev_t;
+		putVarint(out,dt-prev_dt); // delta-of-delta (first entry is a plain delta)
+		putVarint(out,x-prev_x);
+		putVarint(out,y-prev_y);
+		prev_t = t;
+		prev_dt = dt;
+		prev_x = x;
+		prev_y = y;
+	}
+	// flags change rarely, so store them as (flags, run length) pairs
+	vector<std::pair<unsigned int,size_t> > runs;
+	for(size_t i=0;i<n;++i){
+		if(runs.empty()||(runs.back().first!=block[i].flags)){
+			runs.push_back(std::make_pair(block[i].flags,size_t(0)));
+		}
+		++runs.back().second;
+	}
+	putVarint(out,runs.size());
+	for(size_t r=0;r<runs.size();++r){
+		putVarint(out,runs[r].first);
+		putVarint(out,runs[r].second);
+	}
+}
+
+void GazeCodec::encode(const vector<GazeDatum> &data, vector<unsigned char> &out) const{
+	const size_t nr_samples = data.size();
+	const size_t nr_blocks = (nr_samples+block_size-1)/block_size;
+	vector<GazeBlockInfo> index(nr_blocks);
+
+	out.clear();
+	// a rough upper bound for slowly-varying data; the vector will grow if needed
+	out.reserve(HEADER_SIZE+4*nr_samples+INDEX_ENTRY_SIZE*nr_blocks);
+	out.insert(out.end(),MAGIC,MAGIC+4);
+	putFixed(out,FORMAT_VERSION,4);
+	putFixed(out,TICKS_PER_SECOND,4);
+	putFixed(out,doubleBits(position_scale),8);
+	putFixed(out,block_size,4);
+	putFixed(out,nr_samples,8);
+	putFixed(out,nr_blocks,4);
+	putFixed(out,0,8); // index offset; filled in below
+	putFixed(out,units,4);
+	putFixed(out,doubleBits(saccade_velocity_threshold),8);
+
+	for(size_t b=0;b<nr_blocks;++b){
+		const size_t first = b*block_size;
+		const size_t n = (first+block_size<nr_samples)? block_size:nr_samples-first;
+		index[b].offset = out.size();
+		index[b].first_time = data[first].time;
+		index[b].nr_samples = (uint32_t) n;
+		encodeBlock(&data[first],n,out);
+	}
+
+	const uint64_t index_offset = out.size();
+	for(size_t b=0;b<nr_blocks;++b){
+		putFixed(out,index[b].offset,8);
+		putFixed(out,uint64_t(index[b].first_time),8);
+		putFixed(out,index[b].nr_samples,4);
+	}
+	setFixed(&out[INDEX_OFFSET_POS],index_offset,8);
+}
+
+bool GazeCodec::save(const string &filename, const vector<GazeDatum> &data) const{
+	vector<unsigned char> buffer;
+	encode(data,buffer);
+	std::ofstream fs(filename.c_str(),std::ios::out|std::ios::binary);
+	if(!fs){
+		return false;
+	}
+	fs.write(reinterpret_cast<const char*>(&buffer[0]),buffer.size());
+	return fs.good();
+}
+
+
+///////////////////////////////////////////////////////
+////////// GazeArchive Method Definitions /////////////
+GazeArchive::GazeArchive(): data(NULL), length(0), version(0), ticks_per_second(0),
+	ticks_to_us(1), position_scale(1.0), units(GAZE_UNITS_UNKNOWN), saccade_velocity_threshold(0.0),
+	nr_samples(0), index_offset(0){}
+
+bool GazeArchive::open(const string &filename){
+	std::ifstream fs(filename.c_str(),std::ios::in|std::ios::binary);
+	if(!fs){
+		return false;
+	}
+	fs.seekg(0,std::ios::end);
+	const std::streamoff nbytes = fs.tellg();
+	fs.seekg(0,std::ios::beg);
+	if(nbytes<(std::streamoff) HEADER_SIZE_V2){
+		return false;
+	}
+	owned_buffer.resize((size_t) nbytes);
+	fs.read(reinterpret_cast<char*>(&owned_buffer[0]),nbytes);
+	if(!fs){
+		return false;
+	}
+	return attach(&owned_buffer[0],owned_buffer.size());
+}
+
+bool GazeArchive::attach(const unsigned char *buffer, size_t nbytes){
+	// Everything that decodeBlock() relies on is validated here, so that a
+	// truncated or damaged file is rejected rather than read out of bounds.
+	data = NULL;
+	length = 0;
+	nr_samples = 0;
+	index.clear();
+	if((buffer==NULL)||(nbytes<HEADER_SIZE_V2)||(memcmp(buffer,MAGIC,4)!=0)){
+		return false;
+	}
+	version = (uint32_t) getFixed(buffer+4,4);
+	if((version<1)||(version>GazeCodec::FORMAT_VERSION)){
+		return false;
+	}
+	const size_t header_size = (version<3)? HEADER_SIZE_V2:HEADER_SIZE;
+	if(nbytes<header_size){
+		return false;
+	}
+	// files written before version 3 don't record the recording settings
+	units = GAZE_UNITS_UNKNOWN;
+	saccade_velocity_threshold = 0.0;
+	if(version>=3){
+		const uint32_t stored_units = (uint32_t) getFixed(buffer+44,4);
+		units = (stored_units<=GAZE_UNITS_DEGREES)? GazeUnits(stored_units):GAZE_UNITS_UNKNOWN;
+		saccade_velocity_threshold = bitsDouble(getFixed(buffer+48,8));
+		if(!(saccade_velocity_threshold>0.0)||!(saccade_velocity_threshold<HUGE_VAL)){
+			saccade_velocity_threshold = 0.0;
+		}
+	}
+	ticks_per_second = (uint32_t) getFixed(buffer+8,4);
+	if((ticks_per_second==0)||(GazeCodec::TICKS_PER_SECOND%ticks_per_second!=0)){
+		return false;
+	}
+	ticks_to_us = GazeCodec::TICKS_PER_SECOND/ticks_per_second;
+	position_scale = bitsDouble(getFixed(buffer+12,8));
+	if(!(position_scale>0.0)||!(position_scale<HUGE_VAL)){
+		return false;
+	}
+	const uint64_t block_size = getFixed(buffer+20,4);
+	const uint64_t total_samples = getFixed(buffer+24,8);
+	const uint64_t nr_blocks = getFixed(buffer+32,4);
+	index_offset = getFixed(buffer+INDEX_OFFSET_POS,8);
+	if((index_offset<header_size)||(index_offset>nbytes)||
+		(nr_blocks*INDEX_ENTRY_SIZE>nbytes-index_offset)||(nr_blocks*block_size<total_samples)){
+		return false;
+	}
+	// blocks must be contiguous and in order, lie between the header and the
+	// index, and hold no more than block_size samples between them all
+	index.resize((size_t) nr_blocks);
+	uint64_t sample_sum = 0;
+	uint64_t min_offset = header_size;
+	const unsigned char *p = buffer+index_offset;
+	for(size_t b=0;b<index.size();++b,p+=INDEX_ENTRY_SIZE){
+		index[b].offset = getFixed(p,8);
+		index[b].first_time = int64_t(uint64_t(ticks_to_us)*getFixed(p+8,8));
+		index[b].nr_samples = (uint32_t) getFixed(p+16,4);
+		sample_sum += index[b].nr_samples;
+		if((index[b].offset<min_offset)||(index[b].offset>=index_offset)||
+			(index[b].nr_samples==0)||(index[b].nr_samples>block_size)){
+			index.clear();
+			return false;
+		}
+		min_offset = index[b].offset+1;
+	}
+	if(sample_sum!=total_samples){
+		index.clear();
+		return false;
+	}
+	// every sample takes at least three bytes (t,x,y), which also keeps a bad
+	// sample count from triggering a huge allocation in decodeBlock()
+	for(size_t b=0;b<index.size();++b){
+		const uint64_t block_end = (b+1<index.size())? index[b+1].offset:index_offset;
+		if(3*uint64_t(index[b].nr_samples)>block_end-index[b].offset){
+			index.clear();
+			return false;
+		}
+	}
+	nr_samples = total_samples;
+	data = buffer;
+	length = nbytes;
+	return true;
+}
+
+bool GazeArchive::decodeBlock(size_t block, vector<GazeDatum> &out) const{
+	if(block>=index.size()){
+		return false;
+	}
+	const GazeBlockInfo &info = index[block];
+	const double inv_scale = 1.0/position_scale;
+	const unsigned char *p = data+info.offset;
+	// a block ends where the next one (or the index) begins
+	const unsigned char *end = data+((block+1<index.size())? index[block+1].offset:index_offset);
+	// Damaged deltas can carry the running sums out of the int64_t range, so
+	// they are accumulated as unsigned (i.e., modulo 2^64) values.
+	int64_t t0, x0, y0, ddt, dx, dy;
+	if(!getVarint(p,end,t0)||!getVarint(p,end,x0)||!getVarint(p,end,y0)){
+		return false;
+	}
+	uint64_t t = t0, x = x0, y = y0, dt = 0;
+	const uint64_t tick = ticks_to_us;
+	size_t pos = out.size();
+	out.resize(pos+info.nr_samples);
+	GazeDatum *dst = &out[pos];
+	dst[0] = GazeDatum(Point2D(x0*inv_scale,y0*inv_scale),int64_t(tick*t));
+	for(uint32_t i=1;i<info.nr_samples;++i){
+		if(!getVarint(p,end,ddt)||!getVarint(p,end,dx)||!getVarint(p,end,dy)){
+			out.resize(pos);
+			return false;
+		}
+		dt += ddt;
+		t += dt;
+		x += dx;
+		y += dy;
+		dst[i] = GazeDatum(Point2D(int64_t(x)*inv_scale,int64_t(y)*inv_scale),int64_t(tick*t));
+	}
+	if(version<2){
+		return true; // version 1 files carry no flags
+	}
+	int64_t nr_runs;
+	if(!getVarint(p,end,nr_runs)){
+		out.resize(pos);
+		return false;
+	}
+	// the runs must cover the block's samples exactly
+	int64_t remaining = info.nr_samples;
+	for(int64_t r=0;r<nr_runs;++r){
+		int64_t flags, run_length;
+		if(!getVarint(p,end,flags)||!getVarint(p,end,run_length)||
+			(run_length<0)||(run_length>remaining)){
+			out.resize(pos);
+			return false;
+		}
+		for(int64_t i=0;i<run_length;++i){
+			(dst++)->flags = (unsigned int) flags;
+		}
+		remaining -= run_length;
+	}
+	if(remaining!=0){
+		out.resize(pos);
+		return false;
+	}
+	return true;
+}
+
+bool GazeArchive::decodeAll(vector<GazeDatum> &out) const{
+	const size_t pos = out.size();
+	out.reserve(pos+(size_t) nr_samples);
+	for(size_t b=0;b<index.size();++b){
+		if(!decodeBlock(b,out)){
+			out.resize(pos);
+			return false;
+		}
+	}
+	return true;
+}
+
+bool GazeArchive::decodeRange(int64_t start_time, int64_t end_time, vector<GazeDatum> &out) const{
+	// binary search for the last block starting at or before start_time
+	size_t lo = 0, hi = index.size();
+	while(hi-lo>1){
+		size_t mid = (lo+hi)/2;
+		if(index[mid].first_time<=start_time){
+			lo = mid;
+		}else{
+			hi = mid;
+		}
+	}
+	vector<GazeDatum> block_data;
+	for(size_t b=lo;(b<index.size())&&(index[b].first_time<=end_time);++b){
+		block_data.clear();
+		if(!decodeBlock(b,block_data)){
+			return false;
+		}
+		for(size_t i=0;i<block_data.size();++i){
+			if((block_data[i].time>=start_time)&&(block_data[i].time<=end_time)){
+				out.push_back(block_data[i]);
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,80 @@
+// GazeCodec.h
+// Block-based compressed storage format for recorded gaze data.
+//
+// Raw GazeDatum dumps are padded out to 24 bytes per sample. Since timestamps
+// are (nearly) constant-stride and gaze positions change slowly, we instead
+// store, for each block of samples:
+//   - delta-of-delta encoded timestamps,
+//   - fixed-point quantized positions stored as deltas,
+//   - run-length encoded sample flags (blink/invalid; version 2 and later),
+// all as zigzag varints. A per-block index at the end of the file allows
+// individual blocks (or time ranges) to be decoded without touching the rest.
+//
+// File layout (all fixed-width fields little-endian):
+//   header  : magic "EHRT", version, ticks/sec, position scale, block size,
+//             nr samples, nr blocks, index offset, and (version 3 and later)
+//             position units and the online saccade velocity threshold
+//   blocks  : nr_blocks variable-length encoded blocks
+//   index   : nr_blocks x (byte offset, first timestamp, nr samples)
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "GazeDatum.h"
+
+struct GazeBlockInfo{
+	uint64_t offset;	// byte offset of block from start of file
+	int64_t first_time;	// timestamp of first sample in block
+	uint32_t nr_samples;
+};
+
+class GazeCodec{
+	double position_scale;	// quantization steps per position unit
+	uint32_t block_size;	// samples per block
+	GazeUnits units;
+	double saccade_velocity_threshold;	// in units/sec; 0 if saccades weren't classified
+	void encodeBlock(const GazeDatum *data, size_t n, std::vector<unsigned char> &out) const;
+public:
+	static const uint32_t FORMAT_VERSION = 3;
+	static const uint32_t TICKS_PER_SECOND = 1000000; // GazeDatum::time is in us
+	static const uint32_t DEFAULT_BLOCK_SIZE = 1024;
+	// resolution is the smallest representable position step (e.g., 0.01 px)
+	GazeCodec(double resolution=0.01, uint32_t block_size=DEFAULT_BLOCK_SIZE);
+	// settings in effect while the data were recorded (stored in the header)
+	void setRecordingSettings(GazeUnits units, double saccade_velocity_threshold);
+	void encode(const std::vector<GazeDatum> &data, std::vector<unsigned char> &out) const;
+	bool save(const std::string &filename, const std::vector<GazeDatum> &data) const;
+};
+
+// Read-only view of an encoded gaze file. The archive either owns a copy of
+// the file contents (open) or refers to memory managed elsewhere (attach).
+class GazeArchive{
+	std::vector<unsigned char> owned_buffer;
+	const unsigned char *data;
+	size_t length;
+	uint32_t version;
+	uint32_t ticks_per_second;
+	int64_t ticks_to_us;	// files written before the switch to us timestamps use ms ticks
+	double position_scale;
+	GazeUnits units;
+	double saccade_velocity_threshold;
+	uint64_t nr_samples;
+	uint64_t index_offset;	// end of the last block
+	std::vector<GazeBlockInfo> index;
+public:
+	GazeArchive();
+	bool open(const std::string &filename);
+	bool attach(const unsigned char *buffer, size_t nbytes);
+	size_t size() const {return (size_t) nr_samples;}
+	size_t nrBlocks() const {return index.size();}
+	uint32_t getTicksPerSecond() const {return ticks_per_second;}
+	double getResolution() const {return 1.0/position_scale;}
+	GazeUnits getUnits() const {return units;}
+	double getSaccadeVelocityThreshold() const {return saccade_velocity_threshold;} // 0 if unknown/off
+	const GazeBlockInfo &getBlockInfo(size_t block) const {return index[block];}
+	// Each decode method appends to 'out'; they return false (appending
+	// nothing from the damaged block) if the encoded data is corrupt.
+	bool decodeBlock(size_t block, std::vector<GazeDatum> &out) const;
+	bool decodeAll(std::vector<GazeDatum> &out) const;
+	bool decodeRange(int64_t start_time, int64_t end_time, std::vector<GazeDatum> &out) const;
+};
@@ -14,6 +14,7 @@
 #pragma once
 #include <fstream>
 #include <sstream>
+#include <stdint.h>
 #include "Point2D.h"
 
 #ifndef SQR
@@ -21,16 +22,29 @@
 #endif
 
 struct GazeDatum{
+	enum Flags{
+		GAZE_BLINK = 1,		// pupil lost (blink)
+		GAZE_INVALID = 2	// sample flagged as lost or invalid by the tracker
+	};
 	Point2D pos;
-	unsigned int time;
+	int64_t time; // in microseconds
+	unsigned int flags;
 	friend std::ostream &operator<<(std::ostream &ss, GazeDatum &gd){
 		ss.precision(4);
 		ss<<"[ "<<gd.pos.x<<",\t"<<gd.pos.y<<",\t"<<gd.time<<"]";
 		return ss;
 	}
-	GazeDatum(Point2D pos,unsigned int time){
+	GazeDatum(Point2D pos,int64_t time,unsigned int flags=0){
 		this->pos = pos;
 		this->time = time;
+		this->flags = flags;
 	}
-	GazeDatum(): pos(0,0), time(0){}
+	GazeDatum(): pos(0,0), time(0), flags(0){}
+};
+
+// Units of gaze positions (and hence of velocities and thresholds)
+enum GazeUnits{
+	GAZE_UNITS_UNKNOWN = 0,	// e.g., session files written before format version 3
+	GAZE_UNITS_PIXELS = 1,
+	GAZE_UNITS_DEGREES = 2
 };
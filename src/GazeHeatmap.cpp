@@ -0,0 +1,124 @@
+// GazeHeatmap.cpp
+#include <algorithm>
+#include <cmath>
+#include "GazeHeatmap.h"
+
+const size_t GazeHeatmap::FLUSH_SIZE;
+
+GazeHeatmap::GazeHeatmap(): nx(0), ny(0), duration_weighting(false), enabled(false),
+	x_radius(0), y_radius(0), last_time(-1){}
+
+void GazeHeatmap::buildKernel(double sigma_bins, int &radius, std::vector<double> &kernel){
+	if(!(sigma_bins>0.0)){
+		radius = 0;
+		kernel.assign(1,1.0);
+		return;
+	}
+	// truncate at 3 sigma and normalize so each sample contributes unit mass
+	radius = (int) ceil(3.0*sigma_bins);
+	kernel.resize(2*radius+1);
+	double sum = 0.0;
+	for(int i=-radius;i<=radius;++i){
+		kernel[i+radius] = exp(-0.5*SQR(i/sigma_bins));
+		sum += kernel[i+radius];
+	}
+	for(size_t i=0;i<kernel.size();++i){
+		kernel[i] /= sum;
+	}
+}
+
+void GazeHeatmap::configure(int nx, int ny, double xmin, double xmax, double ymin, double ymax,
+	double sigma, bool duration_weighting){
+	if((nx<1)||(ny<1)||!(xmax>xmin)||!(ymax>ymin)){
+		disable();
+		return;
+	}
+	this->nx = nx;
+	this->ny = ny;
+	this->duration_weighting = duration_weighting;
+	extent_min = Point2D(xmin,ymin);
+	bin_size = Point2D((xmax-xmin)/nx,(ymax-ymin)/ny);
+	buildKernel(sigma/bin_size.x,x_radius,x_kernel);
+	buildKernel(sigma/bin_size.y,y_radius,y_kernel);
+	counts.assign(nx*ny,0.0);
+	pending.reserve(2*FLUSH_SIZE);
+	enabled = true;
+	reset();
+}
+
+void GazeHeatmap::disable(){
+	enabled = false;
+	nx = ny = 0;
+	counts.clear();
+	pending.clear();
+	last_time = -1;
+}
+
+void GazeHeatmap::reset(){
+	std::fill(counts.begin(),counts.end(),0.0);
+	pending.clear();
+	last_time = -1;
+}
+
+bool GazeHeatmap::addSample(const Point2D &pos, int64_t time){
+	double weight = 1.0;
+	if(duration_weighting){
+		// each sample stands for the interval since the previous one
+		weight = ((last_time>=0)&&(time>last_time))? 1.0e-6*(time-last_time):0.0;
+		last_time = time;
+	}
+	// NaN-safe bounds check; off-grid (and missing) samples are ignored
+	const double fx = (pos.x-extent_min.x)/bin_size.x;
+	const double fy = (pos.y-extent_min.y)/bin_size.y;
+	if(!(weight>0.0)||!(fx>=0.0)||!(fx<nx)||!(fy>=0.0)||!(fy<ny)){
+		return false;
+	}
+	Bin bin;
+	bin.index = (int) fy+ny*(int) fx;
+	bin.weight = weight;
+	pending.push_back(bin);
+	return pending.size()>=FLUSH_SIZE;
+}
+
+void GazeHeatmap::accumulate(const std::vector<Bin> &bins){
+	for(size_t i=0;i<bins.size();++i){
+		counts[bins[i].index] += bins[i].weight;
+	}
+}
+
+void GazeHeatmap::getMap(std::vector<double> &map) const{
+	if((x_radius==0)&&(y_radius==0)){
+		map = counts;
+		return;
+	}
+	// Separable convolution of the raw histogram, which is equivalent to having
+	// splatted each sample with the kernel (clipped at the grid edges)
+	std::vector<double> smoothed_y(counts.size(),0.0);
+	for(int ix=0;ix<nx;++ix){
+		const double *src = &counts[ny*ix];
+		double *dst = &smoothed_y[ny*ix];
+		for(int iy=0;iy<ny;++iy){
+			if(src[iy]==0.0){
+				continue;
+			}
+			const int lo = std::max(-y_radius,-iy);
+			const int hi = std::min(y_radius,ny-1-iy);
+			for(int dy=lo;dy<=hi;++dy){
+				dst[iy+dy] += src[iy]*y_kernel[dy+y_radius];
+			}
+		}
+	}
+	map.assign(counts.size(),0.0);
+	for(int ix=0;ix<nx;++ix){
+		const int lo = std::max(-x_radius,-ix);
+		const int hi = std::min(x_radius,nx-1-ix);
+		const double *src = &smoothed_y[ny*ix];
+		for(int dx=lo;dx<=hi;++dx){
+			const double w = x_kernel[dx+x_radius];
+			double *dst = &map[ny*(ix+dx)];
+			for(int iy=0;iy<ny;++iy){
+				dst[iy] += w*src[iy];
+			}
+		}
+	}
+}
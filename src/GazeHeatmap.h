@@ -0,0 +1,55 @@
+// GazeHeatmap.h
+// A 2-D gaze density histogram that is accumulated incrementally, one sample
+// at a time, by the sampling thread. The sampler only logs each sample's bin
+// (constant time, independent of grid size and smoothing); logged samples are
+// added to the raw histogram in batches, and since smoothing is linear, the
+// (separable, truncated) Gaussian is applied to the histogram when it's read.
+//
+// Thread use: addSample() and takePending() belong to the sampling side;
+// accumulate() and getMap() to the reading side, which may run concurrently
+// with the sampler as long as the two sides are guarded by separate locks.
+// configure(), disable() and reset() require both.
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "Point2D.h"
+
+class GazeHeatmap{
+public:
+	struct Bin{
+		int index;	// into the column-major grid
+		double weight;
+	};
+private:
+	int nx, ny;			// number of bins along x and y
+	Point2D extent_min;		// lower edge of the first bin
+	Point2D bin_size;
+	bool duration_weighting;	// weight samples by inter-sample interval (sec)
+	bool enabled;
+	int x_radius, y_radius;		// kernel half-widths (in bins)
+	std::vector<double> x_kernel;	// separable Gaussian weights
+	std::vector<double> y_kernel;
+	// sampling side
+	std::vector<Bin> pending;	// logged samples not yet in 'counts'
+	int64_t last_time;		// time of previous sample (us); -1 if none
+	// reading side
+	std::vector<double> counts;	// raw histogram, column-major (ny x nx), as in MATLAB
+	void buildKernel(double sigma_bins, int &radius, std::vector<double> &kernel);
+public:
+	static const size_t FLUSH_SIZE = 1024;	// pending samples worth adding to the histogram
+	GazeHeatmap();
+	// 'sigma' is the Gaussian smoothing width in position units (0 = no smoothing)
+	void configure(int nx, int ny, double xmin, double xmax, double ymin, double ymax,
+		double sigma=0.0, bool duration_weighting=false);
+	void disable();
+	void reset();
+	// Logs a sample; returns true once enough samples are pending to flush
+	bool addSample(const Point2D &pos, int64_t time);
+	void takePending(std::vector<Bin> &bins){bins.clear(); bins.swap(pending);}
+	void accumulate(const std::vector<Bin> &bins);
+	// Writes the smoothed ny x nx map (column-major) to 'map'
+	void getMap(std::vector<double> &map) const;
+	bool isEnabled() const {return enabled;}
+	int getNx() const {return nx;}
+	int getNy() const {return ny;}
+};
@@ -0,0 +1,60 @@
+// GazeKinematics.cpp
+#include "GazeKinematics.h"
+
+const double GazeKinematics::DEFAULT_SACCADE_THRESHOLD = 30.0;
+
+GazeKinematics::GazeKinematics(double saccade_velocity_threshold){
+	this->saccade_velocity_threshold = saccade_velocity_threshold;
+	reset();
+}
+
+void GazeKinematics::reset(){
+	for(int i=0;i<3;++i){
+		history[i] = GazeDatum();
+	}
+	nr_samples = 0;
+	velocity = Point2D(0,0);
+	accel = Point2D(0,0);
+	saccading = false;
+	blinking = false;
+}
+
+void GazeKinematics::addSample(const GazeDatum &gd){
+	//// Treat history as a limited_capacity stack
+	//// and push down the current GazeDatum
+	history[2] = history[1];
+	history[1] = history[0];
+	history[0] = gd;
+	if(nr_samples<3){
+		++nr_samples;
+	}
+	blinking = (gd.flags&GazeDatum::GAZE_BLINK)!=0;
+	if(blinking){
+		// positions are meaningless during a blink, so hold the previous
+		// estimates and restart the history once the blink is over
+		nr_samples = 0;
+		saccading = false;
+		return;
+	}
+	updateVelocityAndAccel();
+	saccading = classifiesSaccades()&&(velocity.vlength()>saccade_velocity_threshold);
+}
+
+void GazeKinematics::updateVelocityAndAccel(){
+	// Times are in microseconds; velocities and accelerations are per second.
+	if(nr_samples<3){
+		return;
+	}
+	const int64_t dt1 = history[1].time-history[2].time;
+	const int64_t dt2 = history[0].time-history[1].time;
+	if((dt1<=0)||(dt2<=0)){
+		return; // no time has elapsed; keep the previous estimates
+	}
+	Point2D v1,v2;
+	v1 = 1.0e6*((history[1].pos)-(history[2].pos))/double(dt1);
+	v2 = 1.0e6*((history[0].pos)-(history[1].pos))/double(dt2);
+	// the velocity estimates are centred on the midpoints of their intervals
+	const double dt_mid = 0.5*double(dt1+dt2);
+	velocity = 0.75*v2+0.25*v1;
+	accel = 1.0e6*(v2-v1)/dt_mid;
+}
@@ -0,0 +1,32 @@
+// GazeKinematics.h
+// Velocity/acceleration estimation and saccade/blink state for a stream of
+// gaze samples. This is shared by the online tracker (EyelinkHRT) and the
+// offline batch analysis (GazeBatch), so both produce identical results when
+// fed the same samples.
+#pragma once
+#include "GazeDatum.h"
+
+class GazeKinematics{
+	GazeDatum history[3];	// the last three samples, newest first
+	int nr_samples;		// samples seen since reset (saturates at 3)
+	Point2D velocity;	// in units/sec
+	Point2D accel;		// in units/sec^2
+	double saccade_velocity_threshold;
+	bool saccading;
+	bool blinking;
+	void updateVelocityAndAccel();
+public:
+	static const double DEFAULT_SACCADE_THRESHOLD; // deg/sec (the Eyelink default)
+	// The threshold is in position units/sec; saccades are only classified
+	// if it is positive, since no single default suits pixel coordinates.
+	GazeKinematics(double saccade_velocity_threshold=0.0);
+	void reset();
+	void setSaccadeVelocityThreshold(double threshold){saccade_velocity_threshold = threshold;}
+	double getSaccadeVelocityThreshold() const {return saccade_velocity_threshold;}
+	bool classifiesSaccades() const {return saccade_velocity_threshold>0.0;}
+	void addSample(const GazeDatum &gd);
+	Point2D getVelocity() const {return velocity;}
+	Point2D getAcceleration() const {return accel;}
+	bool isSaccading() const {return saccading;}
+	bool isBlinking() const {return blinking;}
+};
@@ -0,0 +1,85 @@
+// GazeQuality.cpp
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include "GazeQuality.h"
+
+const size_t GazeQuality::DEFAULT_WINDOW;
+
+GazeQuality::GazeQuality(size_t window_size){
+	setWindowSize(window_size);
+}
+
+void GazeQuality::setWindowSize(size_t window_size){
+	ring.assign((window_size>1)? window_size:2,Entry());
+	reset();
+}
+
+void GazeQuality::reset(){
+	head = count = 0;
+	nr_lost = nr_s2s = nr_fixation = 0;
+	sum_s2s_sq = sum_fixation_m2 = 0.0;
+	prev_valid = false;
+	fixation_length = 0;
+}
+
+void GazeQuality::addSample(const Point2D &pos, int64_t time, bool valid, bool fixating){
+	Entry entry;
+	entry.time = time;
+	entry.valid = valid;
+	entry.has_s2s = valid&&prev_valid;
+	entry.s2s_sq = entry.has_s2s? SQR(pos.x-prev_pos.x)+SQR(pos.y-prev_pos.y):0.0;
+	entry.fixating = valid&&fixating;
+	entry.fixation_m2 = 0.0;
+	if(entry.fixating){
+		// Welford update of the ongoing fixation's mean; summing the increments
+		// over a fixation gives its total sum of squared deviations
+		++fixation_length;
+		Point2D delta = pos-fixation_mean;
+		fixation_mean = fixation_mean+delta/double(fixation_length);
+		entry.fixation_m2 = delta.x*(pos.x-fixation_mean.x)+delta.y*(pos.y-fixation_mean.y);
+	}else{
+		fixation_length = 0;
+		fixation_mean = Point2D(0,0);
+	}
+	prev_valid = valid;
+	prev_pos = pos;
+
+	// drop the oldest entry's contributions once the window is full
+	if(count==ring.size()){
+		const Entry &oldest = ring[head];
+		nr_lost -= !oldest.valid;
+		nr_s2s -= oldest.has_s2s;
+		sum_s2s_sq -= oldest.s2s_sq;
+		nr_fixation -= oldest.fixating;
+		sum_fixation_m2 -= oldest.fixation_m2;
+		head = (head+1)%ring.size();
+		--count;
+	}
+	ring[(head+count)%ring.size()] = entry;
+	++count;
+	nr_lost += !entry.valid;
+	nr_s2s += entry.has_s2s;
+	sum_s2s_sq += entry.s2s_sq;
+	nr_fixation += entry.fixating;
+	sum_fixation_m2 += entry.fixation_m2;
+}
+
+GazeQualityMetrics GazeQuality::getMetrics() const{
+	const double nan = std::numeric_limits<double>::quiet_NaN();
+	GazeQualityMetrics metrics;
+	metrics.nr_samples = count;
+	// running sums can drift slightly below zero through rounding
+	metrics.rms_s2s = (nr_s2s>0)? sqrt(std::max(sum_s2s_sq,0.0)/nr_s2s):nan;
+	metrics.fixation_sd = (nr_fixation>1)? sqrt(std::max(sum_fixation_m2,0.0)/nr_fixation):nan;
+	metrics.data_loss = (count>0)? double(nr_lost)/count:nan;
+	metrics.sampling_rate = nan;
+	if(count>1){
+		const int64_t newest = ring[(head+count-1)%ring.size()].time;
+		const int64_t span = newest-ring[head].time;
+		if(span>0){
+			metrics.sampling_rate = 1.0e6*(count-1)/double(span);
+		}
+	}
+	return metrics;
+}
@@ -0,0 +1,47 @@
+// GazeQuality.h
+// Rolling-window data-quality metrics for a single eye, updated in constant
+// time per tracker sample via running sums over a fixed-size ring buffer.
+#pragma once
+#include <stdint.h>
+#include <vector>
+#include "Point2D.h"
+
+struct GazeQualityMetrics{
+	double rms_s2s;		// RMS sample-to-sample distance (precision)
+	double fixation_sd;	// pooled 2-D standard deviation within fixations
+	double data_loss;	// fraction of lost/invalid samples
+	double sampling_rate;	// effective rate (Hz) of new tracker samples
+	size_t nr_samples;	// number of samples currently in the window
+};
+
+class GazeQuality{
+	struct Entry{
+		int64_t time;		// in microseconds
+		bool valid;
+		bool has_s2s;		// both this and the previous sample were valid
+		bool fixating;
+		double s2s_sq;		// squared distance from the previous sample
+		double fixation_m2;	// this sample's increment to the fixation's sum of squares
+	};
+	std::vector<Entry> ring;
+	size_t head;			// index of the oldest entry
+	size_t count;
+	// running sums over the window
+	size_t nr_lost;
+	size_t nr_s2s;
+	double sum_s2s_sq;
+	size_t nr_fixation;
+	double sum_fixation_m2;
+	// state carried between consecutive samples
+	bool prev_valid;
+	Point2D prev_pos;
+	size_t fixation_length;		// samples in the ongoing fixation
+	Point2D fixation_mean;
+public:
+	static const size_t DEFAULT_WINDOW = 1000;
+	GazeQuality(size_t window_size=DEFAULT_WINDOW);
+	void setWindowSize(size_t window_size);
+	void reset();
+	void addSample(const Point2D &pos, int64_t time, bool valid, bool fixating);
+	GazeQualityMetrics getMetrics() const;
+};
@@ -0,0 +1,25 @@
+// GazeSource.h
+// Interface for the sample streams that an EyelinkHRT sampler can run on: the
+// live Eyelink link (LiteTracker) or a recorded session (ReplaySource). Each
+// sampler owns its source, so live and replayed pipelines can run side by side.
+#pragma once
+#include <stdint.h>
+#include "GazeDatum.h"
+#include "Point2D.h"
+
+class GazeSource{
+public:
+	virtual ~GazeSource(){}
+	virtual void setTrackingEye(int tracking_eye) = 0;
+	// Advances to the oldest sample not yet seen by this source; returns false
+	// if no new sample is available. The accessors below refer to that sample.
+	virtual bool nextSample() = 0;
+	virtual int64_t getSampleTime() const = 0; // source clock, in us
+	virtual Point2D getGazePosition() = 0;
+	virtual Point2D getResolution() = 0; // pixels/degree estimate; (0,0) if unknown
+	virtual bool getBlinkSignal() = 0;
+	virtual bool isSampleValid() = 0; // false for lost/invalid samples
+	// Units of getGazePosition(); screen positions are converted to degrees by
+	// the sampler once a display geometry is set
+	virtual GazeUnits getUnits() const {return GAZE_UNITS_PIXELS;}
+};
@@ -1,91 +1,207 @@
 // LiteTracker.cpp
 // This is a lightweight version of the Eyelink tracker class (with limited functionality)
 // meant for use in tandem with Matlab mex files and the PTB Eyelink toolbox.
+#include <algorithm>
+#include <cstring>
+#include <deque>
 #include "LiteTracker.h"
 
 // added following to use portable std::chrono for timing
 #if __cplusplus > 199711L
 	#include <chrono>
+	#include <mutex>
 	namespace chrono = std::chrono;
+	namespace stdx = std;
 #else
 // Import boost libraries (unnecessary if compiling under C++11 or later)
 	#include <boost/chrono.hpp>
+	#include <boost/thread.hpp>
 	namespace chrono = boost::chrono;
+	namespace stdx = boost;
 #endif
 
-using chrono::milliseconds;
-typedef chrono::high_resolution_clock hr_clock;
+using chrono::microseconds;
+typedef chrono::steady_clock hr_clock;
+
+// The Eyelink library isn't documented as thread-safe, and each LiteTracker is
+// polled from its own sampling thread, so all link access goes through this.
+static stdx::mutex link_mutex;
+static bool drain_link = false; // see LiteTracker::setLinkDraining(); guarded by link_mutex
 
 /// Utility functions
-unsigned long get_time(){
+int64_t get_time(){
+	// microseconds on the same monotonic clock used by EyelinkHRT
 	hr_clock::time_point chron_tp = hr_clock::now();
-	milliseconds chron_ms = chrono::duration_cast<milliseconds>(chron_tp.time_since_epoch());
-	return chron_ms.count();
+	microseconds chron_us = chrono::duration_cast<microseconds>(chron_tp.time_since_epoch());
+	return chron_us.count();
+}
+
+#ifndef SIMULATE_EYETRACKER
+static int64_t sampleTime(const FSAMPLE &fs){
+	// tracker time, in us (2 kHz samples fall on the half millisecond)
+	return 1000*int64_t(fs.time)+((fs.flags&SAMPLE_ADD_OFFSET)? 500:0);
+}
+
+// The link's data queue can only be read once, but every LiteTracker (e.g.,
+// one per eye) has to see every sample. So when draining, a single shared
+// reader empties the queue into a short history, from which each tracker takes
+// the samples that are newer than the last one it consumed.
+struct LinkSample{
+	int64_t time; // tracker time, in us
+	FSAMPLE data;
+};
+static std::deque<LinkSample> link_history; // oldest first; guarded by link_mutex
+static const size_t LINK_HISTORY_SIZE = 4096; // about 2 s at 2 kHz
+
+static bool isBefore(int64_t time, const LinkSample &sample){
+	return time<sample.time;
+}
+
+static void drainLink(){
+	// Must be called with link_mutex held. Events are discarded.
+	ALLF_DATA item;
+	int type;
+	while((type = eyelink_get_next_data(NULL))!=0){
+		if(type!=SAMPLE_TYPE){
+			continue;
+		}
+		eyelink_get_float_data(&item);
+		LinkSample sample;
+		sample.time = sampleTime(item.fs);
+		sample.data = item.fs;
+		if(!link_history.empty()&&(sample.time<=link_history.back().time)){
+			continue; // already seen
+		}
+		link_history.push_back(sample);
+		if(link_history.size()>LINK_HISTORY_SIZE){
+			link_history.pop_front();
+		}
+	}
 }
+#endif //SIMULATE_EYETRACKER
 
 
 ///////////////////////////////////////////////////////
 ////////// Method Definitions /////////////////////////
-LiteTracker::LiteTracker(int tracking_eye){
+LiteTracker::LiteTracker(int tracking_eye): blink_signal(false), last_sample_time(-1){
 	printf("\n...constructing LiteTracker...\n");
 	this->tracking_eye = tracking_eye;
+	memset(&current_data,0,sizeof(current_data));
 #ifndef SIMULATE_EYETRACKER
+	link_mutex.lock();
 	if(!eyelink_is_connected()){
 		open_eyelink_connection(0);
 	}
+	link_mutex.unlock();
 #endif //SIMULATE_EYETRACKER
 	is_recording = true;
 }
 
-LiteTracker *LiteTracker::getInstance(int tracking_eye){
-	printf("\n...entered LiteTracker::getInstance()...\n");
-	if(unique_instance == NULL){
-		unique_instance = new LiteTracker(tracking_eye);
-	}
-	LiteTracker::tracking_eye = tracking_eye;
-	return unique_instance;
+void LiteTracker::setTrackingEye(int tracking_eye){
+	this->tracking_eye = tracking_eye;
+}
+
+void LiteTracker::setLinkDraining(bool drain){
+	stdx::lock_guard<stdx::mutex> lock(link_mutex);
+	drain_link = drain;
 }
 
-bool LiteTracker::refreshDataSample(){
-	if(eyelink_is_connected()&&(eyelink_newest_float_sample(&current_data)>0)){
-		//last_sample_time = timeGetTime();
-		last_sample_time = get_time();
+bool LiteTracker::isLinkDraining(){
+	stdx::lock_guard<stdx::mutex> lock(link_mutex);
+	return drain_link;
+}
+
+bool LiteTracker::nextSample(){
+#ifndef SIMULATE_EYETRACKER
+	// Whether a sample is new is decided per tracker, by comparing its
+	// timestamp with that of the last sample this tracker consumed.
+	if(!is_recording){
+		return false;
+	}
+	stdx::lock_guard<stdx::mutex> lock(link_mutex);
+	if(!eyelink_is_connected()){
+		return false;
+	}
+	if(!drain_link){
+		// non-destructive, so the Toolbox still sees every sample and event
+		FSAMPLE newest;
+		if(eyelink_newest_float_sample(&newest)<=0){
+			return false;
+		}
+		const int64_t sample_time = sampleTime(newest);
+		if(sample_time<=last_sample_time){
+			return false;
+		}
+		current_data = newest;
+		last_sample_time = sample_time;
 		return true;
 	}
-	return false;
+	// Drain the link's data queue rather than reading only the newest sample,
+	// so no sample is skipped when the tracker runs faster than we poll (e.g.,
+	// at 2 kHz).
+	drainLink();
+	std::deque<LinkSample>::const_iterator next =
+		std::upper_bound(link_history.begin(),link_history.end(),last_sample_time,isBefore);
+	if(next==link_history.end()){
+		return false;
+	}
+	current_data = next->data;
+	last_sample_time = next->time;
+	return true;
+#else
+	// a simulated 1 kHz tracker, time-stamped with the host clock
+	const int64_t sample_time = 1000*(get_time()/1000);
+	if(!is_recording||(sample_time<=last_sample_time)){
+		return false;
+	}
+	last_sample_time = sample_time;
+	return true;
+#endif //SIMULATE_EYETRACKER
 }
 
 Point2D LiteTracker::getGazePosition(){
+	// Uses the sample fetched by the last call to nextSample()
 	double x,y;
 #ifndef SIMULATE_EYETRACKER
-	if(is_recording&&(get_time()!=last_sample_time)){
-		refreshDataSample();
-	}
 	x = current_data.gx[tracking_eye];
 	y = current_data.gy[tracking_eye];
 #else
-	if(is_recording){
-		last_sample_time = get_time();
-	}
 	x = 0.0;
 	y = 0.0;
 #endif //SIMULATE_EYETRACKER
 	this->position = Point2D(x,y);
 	return position;
 }
+Point2D LiteTracker::getResolution(){
+	// Uses the sample fetched by the last call to nextSample()
+#ifndef SIMULATE_EYETRACKER
+	return Point2D(current_data.rx,current_data.ry);
+#else
+	return Point2D(0.0,0.0);
+#endif //SIMULATE_EYETRACKER
+}
+
+bool LiteTracker::isSampleValid(){
+#ifndef SIMULATE_EYETRACKER
+	// lost samples have zero pupil size and/or missing gaze; nonzero status
+	// indicates a tracker-reported problem with the sample
+	return (current_data.pa[tracking_eye]>0.0)&&
+		(current_data.gx[tracking_eye]!=MISSING_DATA)&&
+		(current_data.gy[tracking_eye]!=MISSING_DATA)&&
+		(current_data.status==0);
+#else
+	return true;
+#endif //SIMULATE_EYETRACKER
+}
+
 bool LiteTracker::getBlinkSignal(){
+	// Uses the sample fetched by the last call to nextSample()
 #ifndef SIMULATE_EYETRACKER
-	if(get_time()!=last_sample_time){
-		refreshDataSample();
-	}
-	this->blink_signal = !(current_data.pa[1]>0.0);	// pa[0] is size (diameter?), pa[1] is area.
-	printf("\n...detected blink...\n");				// both values should be zero during a blink.
+	// This is polled for every sample, so don't print anything here.
+	// pa[] holds the pupil size for each eye, which is zero during a blink.
+	this->blink_signal = !(current_data.pa[tracking_eye]>0.0);
 #else
 	blink_signal = false;
 #endif //SIMULATE_EYETRACKER
 	return blink_signal;							
 }
-
-LiteTracker *LiteTracker::unique_instance = NULL;
-bool LiteTracker::is_recording;
-int LiteTracker::tracking_eye = 1;
\ No newline at end of file
@@ -5,24 +5,41 @@
 #pragma once
 #include <cstdio>
 #include <string>
+#include <stdint.h>
 #include <core_expt.h>
+#include "GazeSource.h"
 #include "Point2D.h"
 
-class LiteTracker{
-	static LiteTracker *unique_instance;
+class LiteTracker: public GazeSource{
 	Point2D position;
 	bool blink_signal;
-	static bool is_recording;
+	bool is_recording;
+	int tracking_eye;
 	UINT32 tracker_time_offset;// offset in msec between tracker and display computer
 	FSAMPLE current_data;// current data sample
 	FEVENT current_event; // current event sample
-	unsigned int last_sample_time;
-	bool refreshDataSample();
-	LiteTracker(int tracking_eye=1);
+	int64_t last_sample_time; // tracker time (us) of the current sample; -1 if none
 public:
-	static int tracking_eye;
+	// Several LiteTrackers may share the same Eyelink connection (e.g., one per
+	// eye); calls into the Eyelink library are serialized between them, and
+	// each of them receives every sample.
+	LiteTracker(int tracking_eye=1);
+	// By default, trackers only read the newest sample (which leaves the link's
+	// data queue to the Eyelink Toolbox, but skips samples when the tracker runs
+	// faster than it is polled). With draining on, every queued sample is read;
+	// this consumes the queue, events included, for all LiteTrackers.
+	static void setLinkDraining(bool drain);
+	static bool isLinkDraining();
+	void setTrackingEye(int tracking_eye);
+	int getTrackingEye() const {return tracking_eye;}
+	// Advances to the next sample not yet seen by this tracker (the oldest one
+	// if draining, else the newest); returns false if no new sample has arrived.
+	// The accessors below refer to that sample.
+	bool nextSample();
+	int64_t getSampleTime() const {return last_sample_time;} // tracker clock, in us
 	Point2D getGazePosition();
+	Point2D getResolution(); // tracker's pixels/degree estimate (FSAMPLE.rx/ry)
 	bool getBlinkSignal();
+	bool isSampleValid(); // false for lost/invalid samples
 	~LiteTracker(){}
-	static LiteTracker *getInstance(int tracking_eye);
 };
\ No newline at end of file
@@ -0,0 +1,103 @@
+// MappedFile.cpp
+#include "MappedFile.h"
+
+#ifdef _WIN32
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(): data(NULL), length(0), file_handle(INVALID_HANDLE_VALUE), mapping_handle(NULL){}
+#else
+MappedFile::MappedFile(): data(NULL), length(0), fd(-1){}
+#endif
+
+MappedFile::~MappedFile(){
+	close();
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string &filename){
+	close();
+	file_handle = CreateFileA(filename.c_str(),GENERIC_READ,FILE_SHARE_READ,NULL,
+		OPEN_EXISTING,FILE_FLAG_SEQUENTIAL_SCAN,NULL);
+	if(file_handle==INVALID_HANDLE_VALUE){
+		return false;
+	}
+	LARGE_INTEGER file_size;
+	if(!GetFileSizeEx(file_handle,&file_size)||(file_size.QuadPart==0)){
+		close();
+		return false;
+	}
+	mapping_handle = CreateFileMappingA(file_handle,NULL,PAGE_READONLY,0,0,NULL);
+	if(mapping_handle==NULL){
+		close();
+		return false;
+	}
+	data = (const unsigned char*) MapViewOfFile(mapping_handle,FILE_MAP_READ,0,0,0);
+	if(data==NULL){
+		close();
+		return false;
+	}
+	length = (size_t) file_size.QuadPart;
+	return true;
+}
+
+void MappedFile::close(){
+	if(data!=NULL){
+		UnmapViewOfFile(data);
+	}
+	if(mapping_handle!=NULL){
+		CloseHandle(mapping_handle);
+	}
+	if(file_handle!=INVALID_HANDLE_VALUE){
+		CloseHandle(file_handle);
+	}
+	data = NULL;
+	length = 0;
+	mapping_handle = NULL;
+	file_handle = INVALID_HANDLE_VALUE;
+}
+#else
+bool MappedFile::open(const std::string &filename){
+	close();
+	fd = ::open(filename.c_str(),O_RDONLY);
+	if(fd<0){
+		return false;
+	}
+	struct stat st;
+	if((fstat(fd,&st)!=0)||(st.st_size==0)){
+		close();
+		return false;
+	}
+	void *ptr = mmap(NULL,(size_t) st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+	if(ptr==MAP_FAILED){
+		close();
+		return false;
+	}
+	// the whole file is decoded front to back
+	madvise(ptr,(size_t) st.st_size,MADV_SEQUENTIAL);
+	data = (const unsigned char*) ptr;
+	length = (size_t) st.st_size;
+	return true;
+}
+
+void MappedFile::close(){
+	if(data!=NULL){
+		munmap((void*) data,length);
+	}
+	if(fd>=0){
+		::close(fd);
+	}
+	data = NULL;
+	length = 0;
+	fd = -1;
+}
+#endif
@@ -0,0 +1,26 @@
+// MappedFile.h
+// Read-only memory mapping of a whole file (POSIX mmap or Win32 file mapping),
+// so recorded sessions can be decoded without first copying them into memory.
+#pragma once
+#include <string>
+
+class MappedFile{
+	const unsigned char *data;
+	size_t length;
+#ifdef _WIN32
+	void *file_handle;
+	void *mapping_handle;
+#else
+	int fd;
+#endif
+	// not copyable
+	MappedFile(const MappedFile &);
+	MappedFile &operator=(const MappedFile &);
+public:
+	MappedFile();
+	~MappedFile();
+	bool open(const std::string &filename);
+	void close();
+	const unsigned char *getData() const {return data;}
+	size_t size() const {return length;}
+};
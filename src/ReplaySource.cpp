@@ -0,0 +1,79 @@
+// ReplaySource.cpp
+#include "ReplaySource.h"
+
+namespace chrono = stdx::chrono;
+using chrono::microseconds;
+typedef chrono::steady_clock hr_clock;
+
+
+///////////////////////////////////////////////////////
+////////// Method Definitions /////////////////////////
+ReplaySource::ReplaySource(): loop(false), block_nr(0), sample_nr(0), first_time(0),
+	loop_offset(0), period(0), started(false){}
+
+bool ReplaySource::open(const std::string &filename, bool loop){
+	std::vector<GazeDatum> last_block;
+	if(!archive.open(filename)||(archive.size()==0)||
+		!archive.decodeBlock(archive.nrBlocks()-1,last_block)){
+		return false;
+	}
+	this->loop = loop;
+	block.clear();
+	block_nr = sample_nr = 0;
+	loop_offset = 0;
+	started = false;
+	first_time = archive.getBlockInfo(0).first_time;
+	// a pass lasts until one sample interval after the last sample, so looped
+	// playback keeps the file's sampling rate across the seam
+	const size_t n = last_block.size();
+	const int64_t interval = (n>1)? last_block[n-1].time-last_block[n-2].time:1000;
+	period = last_block[n-1].time-first_time+((interval>0)? interval:1000);
+	return true;
+}
+
+GazeUnits ReplaySource::getUnits() const{
+	// files written before units were recorded hold screen positions
+	return (archive.getUnits()==GAZE_UNITS_DEGREES)? GAZE_UNITS_DEGREES:GAZE_UNITS_PIXELS;
+}
+
+bool ReplaySource::peekSample(GazeDatum &gd){
+	// the next sample in file order, shifted by the current pass's offset
+	while(sample_nr>=block.size()){
+		if(block_nr>=archive.nrBlocks()){
+			if(!loop){
+				return false;
+			}
+			block_nr = 0;
+			loop_offset += period;
+		}
+		block.clear();
+		sample_nr = 0;
+		if(!archive.decodeBlock(block_nr++,block)){
+			return false; // damaged block; playback stops here
+		}
+	}
+	gd = block[sample_nr];
+	gd.time += loop_offset;
+	return true;
+}
+
+bool ReplaySource::nextSample(){
+	// Samples are released as soon as playback has run as long as the
+	// recording had when they were taken; the clock starts at the first call.
+	const hr_clock::time_point now = hr_clock::now();
+	if(!started){
+		started = true;
+		start_time = now;
+	}
+	GazeDatum gd;
+	if(!peekSample(gd)){
+		return false;
+	}
+	const int64_t elapsed = chrono::duration_cast<microseconds>(now-start_time).count();
+	if(gd.time-first_time>elapsed){
+		return false;
+	}
+	current = gd;
+	++sample_nr;
+	return true;
+}
@@ -0,0 +1,48 @@
+// ReplaySource.h
+// A GazeSource that plays back a session file (as written by
+// eyelink_hrt('save',...)) in real time, e.g., to test an experiment without a
+// tracker or to run a recorded stream alongside a live one. Blocks are decoded
+// as playback reaches them, so long sessions needn't be decoded up front.
+#pragma once
+#include <string>
+#include <vector>
+#include "GazeCodec.h"
+#include "GazeSource.h"
+
+#if (__cplusplus > 199711L)
+	#include <chrono>
+	namespace stdx = std;
+#else
+// Import boost libraries (unnecessary if compiling under C++11 or later)
+	#include <boost/chrono.hpp>
+	namespace stdx = boost;
+#endif
+
+class ReplaySource: public GazeSource{
+	GazeArchive archive;
+	bool loop;			// restart from the beginning once the file is exhausted
+	std::vector<GazeDatum> block;	// decoded samples of the current block
+	size_t block_nr;
+	size_t sample_nr;		// next sample within 'block'
+	int64_t first_time;		// file time of the first sample (us)
+	int64_t loop_offset;		// added to file times on each pass (us)
+	int64_t period;			// duration of one pass (us)
+	bool started;
+	stdx::chrono::steady_clock::time_point start_time;
+	GazeDatum current;
+	bool peekSample(GazeDatum &gd);
+	// not copyable (the archive refers to its own buffer)
+	ReplaySource(const ReplaySource &);
+	ReplaySource &operator=(const ReplaySource &);
+public:
+	ReplaySource();
+	bool open(const std::string &filename, bool loop=false);
+	void setTrackingEye(int){} // the file holds a single eye
+	bool nextSample();
+	int64_t getSampleTime() const {return current.time;}
+	Point2D getGazePosition(){return current.pos;}
+	Point2D getResolution(){return Point2D(0.0,0.0);}
+	bool getBlinkSignal(){return (current.flags&GazeDatum::GAZE_BLINK)!=0;}
+	bool isSampleValid(){return (current.flags&GazeDatum::GAZE_INVALID)==0;}
+	GazeUnits getUnits() const;
+};
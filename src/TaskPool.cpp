@@ -0,0 +1,66 @@
+// TaskPool.cpp
+#include "TaskPool.h"
+
+TaskPool::TaskPool(unsigned int nr_threads){
+	if(nr_threads==0){
+		nr_threads = stdx::thread::hardware_concurrency();
+	}
+	this->nr_threads = (nr_threads>0)? nr_threads:1;
+}
+
+bool TaskPool::popLocal(unsigned int id, size_t &item){
+	WorkQueue *queue = queues[id];
+	stdx::lock_guard<stdx::mutex> lock(queue->mutex);
+	if(queue->items.empty()){
+		return false;
+	}
+	item = queue->items.back();
+	queue->items.pop_back();
+	return true;
+}
+
+bool TaskPool::steal(unsigned int id, size_t &item){
+	for(unsigned int i=1;i<nr_threads;++i){
+		WorkQueue *victim = queues[(id+i)%nr_threads];
+		stdx::lock_guard<stdx::mutex> lock(victim->mutex);
+		if(!victim->items.empty()){
+			item = victim->items.front();
+			victim->items.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void TaskPool::worker(unsigned int id, Task *task){
+	// No new items are added while running, so once the local queue and all
+	// other queues are empty there's nothing left for this thread to do.
+	size_t item;
+	while(popLocal(id,item)||steal(id,item)){
+		task->run(item);
+	}
+}
+
+void TaskPool::run(Task &task, size_t nr_items){
+	queues.resize(nr_threads);
+	for(unsigned int i=0;i<nr_threads;++i){
+		queues[i] = new WorkQueue();
+	}
+	// deal items out round-robin; local pops take from the back, so each
+	// thread starts with its highest-numbered item
+	for(size_t item=0;item<nr_items;++item){
+		queues[item%nr_threads]->items.push_back(item);
+	}
+	std::vector<stdx::thread*> threads(nr_threads);
+	for(unsigned int i=0;i<nr_threads;++i){
+		threads[i] = new stdx::thread(&TaskPool::worker,this,i,&task);
+	}
+	for(unsigned int i=0;i<nr_threads;++i){
+		threads[i]->join();
+		delete threads[i];
+	}
+	for(unsigned int i=0;i<nr_threads;++i){
+		delete queues[i];
+	}
+	queues.clear();
+}
@@ -0,0 +1,40 @@
+// TaskPool.h
+// A small work-stealing thread pool for batch processing. Items are dealt out
+// round-robin to per-thread queues; each thread works through its own queue
+// from the back and, once that's empty, steals from the front of the others.
+#pragma once
+#include <deque>
+#include <vector>
+
+#if (__cplusplus > 199711L)
+	#include <thread>
+	#include <mutex>
+	namespace stdx = std;
+#else
+// Import boost libraries (unnecessary if compiling under C++11 or later)
+	#include <boost/thread.hpp>
+	namespace stdx = boost;
+#endif
+
+class TaskPool{
+public:
+	class Task{
+	public:
+		virtual ~Task(){}
+		virtual void run(size_t item) = 0; // called concurrently from the worker threads
+	};
+	TaskPool(unsigned int nr_threads=0); // 0 = one thread per hardware core
+	unsigned int getNrThreads() const {return nr_threads;}
+	// processes items 0..nr_items-1 and returns once all of them are done
+	void run(Task &task, size_t nr_items);
+private:
+	struct WorkQueue{
+		stdx::mutex mutex;
+		std::deque<size_t> items;
+	};
+	unsigned int nr_threads;
+	std::vector<WorkQueue*> queues;
+	bool popLocal(unsigned int id, size_t &item);
+	bool steal(unsigned int id, size_t &item);
+	void worker(unsigned int id, Task *task);
+};
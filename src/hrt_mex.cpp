@@ -1,51 +1,122 @@
 #include <string>
 #include <algorithm>
+#include <map>
 #include <mex.h>
 #include "LiteTracker.h"
+#include "ReplaySource.h"
 #include "EyelinkHRT.h"
+#include "GazeCodec.h"
 
 #define EPS (1e-10)
+#define US_TO_SEC (1e-6) // timestamps are kept in microseconds
 
-EyelinkHRT* hrt;
-static LiteTracker* lt;
-static bool is_initialized = false;
+#define DEFAULT_HANDLE (0) // tracker used by commands that don't specify a handle
+#define DEFAULT_EYE (1)
+
+// Each tracker pipeline (a GazeSource + EyelinkHRT, with its own sampling
+// thread) is addressed from MATLAB by an integer handle.
+struct HRTInstance{
+	GazeSource *source;
+	EyelinkHRT *hrt;
+};
+static std::map<int,HRTInstance> trackers;
+static int next_handle = DEFAULT_HANDLE+1;
 
 static void cleanup();
 
-void init(int tracking_eye){
-	mexLock(); // new addition: locks mex file from being cleared.
-	printf("\n...Initializing HRT tracker...\n");
-	lt = LiteTracker::getInstance(tracking_eye);
-	hrt = EyelinkHRT::getInstance(lt);
-	hrt->startTracking();
-	is_initialized = true;
+EyelinkHRT *init(int handle, GazeSource *source){
+	if(trackers.empty()){
+		mexLock(); // new addition: locks mex file from being cleared.
+		mexAtExit(cleanup);
+	}
+	printf("\n...Initializing HRT tracker %d...\n",handle);
+	HRTInstance instance;
+	instance.source = source;
+	instance.hrt = new EyelinkHRT(instance.source);
+	instance.hrt->startTracking();
+	trackers[handle] = instance;
 	printf("\n...HRT tracker initialized...\n");
-	mexAtExit(cleanup);
+	return instance.hrt;
 }
 
-void startRecording(int tracking_eye){
-	printf("\n...starting record...\n");
-	if(!is_initialized){
-		init(tracking_eye);
+EyelinkHRT *findTracker(int handle){
+	std::map<int,HRTInstance>::iterator it = trackers.find(handle);
+	if(it==trackers.end()){
+		mexErrMsgTxt("ERROR: no tracker is running for this handle.");
+	}
+	return it->second.hrt;
+}
+
+EyelinkHRT *getTracker(int handle, int tracking_eye){
+	// the default tracker is created on first use; others must be opened explicitly
+	std::map<int,HRTInstance>::iterator it = trackers.find(handle);
+	if(it!=trackers.end()){
+		return it->second.hrt;
+	}
+	if(handle!=DEFAULT_HANDLE){
+		mexErrMsgTxt("ERROR: no tracker is running for this handle.");
+	}
+	if(tracking_eye<0){
+		mexErrMsgTxt("ERROR: the second parameter must indicate the tracked eye (0=left;1=right).");
+	}
+	return init(handle,new LiteTracker(tracking_eye));
+}
+
+int openTracker(int nrhs, const mxArray *prhs[]){
+	// eyelink_hrt('open',TRACKING_EYE) opens another Eyelink pipeline;
+	// eyelink_hrt('open','replay',FILENAME,LOOP) plays back a saved session
+	GazeSource *source;
+	if(mxIsChar(prhs[1])){
+		std::string type = std::string(mxArrayToString(prhs[1]));
+		std::transform(type.begin(),type.end(),type.begin(),::tolower);
+		if((type!="replay")||(nrhs<3)||!mxIsChar(prhs[2])){
+			mexErrMsgTxt("ERROR: the source must be a tracked eye (0=left;1=right) or 'replay' followed by a file name.");
+		}
+		ReplaySource *replay = new ReplaySource();
+		bool loop = (nrhs>3)&&(mxGetScalar(prhs[3])!=0);
+		if(!replay->open(std::string(mxArrayToString(prhs[2])),loop)){
+			delete replay;
+			mexErrMsgTxt("ERROR: unable to read gaze data file.");
+		}
+		source = replay;
+	}else{
+		source = new LiteTracker((int) mxGetScalar(prhs[1]));
+	}
+	int handle = next_handle++;
+	init(handle,source);
+	return handle;
+}
+
+void closeTracker(int handle){
+	std::map<int,HRTInstance>::iterator it = trackers.find(handle);
+	if(it==trackers.end()){
+		return;
 	}
-	LiteTracker::tracking_eye = tracking_eye;
+	printf("\n...deleting HRT %d...\n",handle);
+	it->second.hrt->stopTracking();
+	delete it->second.hrt;
+	delete it->second.source;
+	trackers.erase(it);
+	if(trackers.empty()){
+		mexUnlock();
+	}
+}
+
+void startRecording(EyelinkHRT *hrt, int tracking_eye){
+	printf("\n...starting record...\n");
+	hrt->setTrackingEye(tracking_eye);
 	hrt->startRecording();
 }
 
-void stopRecording(mxArray **output){
-	printf("\n...ending record...\n");
-	// 1. stop recording data
-	hrt->stopRecording();
-	// 2. get gaze data as a vector
-	std::vector<GazeDatum> gd = hrt->getGazeData();
-	// 3. load these data into a ublas matrix
+void gazeDataToMatrix(const std::vector<GazeDatum> &gd, mxArray **output){
+	// load gaze data into a column-major Nx3 (x,y,t) array
 	unsigned nr_samples = gd.size();
 	std::vector<double> gaze_dat(3*nr_samples);
 
 	for(unsigned int i=0; i<nr_samples;++i){
 		gaze_dat[i] = gd[i].pos.x;
 		gaze_dat[i+nr_samples*1] = gd[i].pos.y;
-		gaze_dat[i+nr_samples*2] = gd[i].time*0.001; // convert time unit to seconds;
+		gaze_dat[i+nr_samples*2] = gd[i].time*US_TO_SEC; // convert time unit to seconds;
 	}
 	//printf("\n...creating matlab matrix...\n");
 	// 4. create a MATLAB matrix to hold the output
@@ -59,51 +130,181 @@ void stopRecording(mxArray **output){
 	//printf("\n...data copied...\n");
 }
 
-void getCurrentPos(int tracking_eye,mxArray **output){
-	if(!is_initialized){
-		init(tracking_eye);
+void stopRecording(EyelinkHRT *hrt, mxArray **output){
+	printf("\n...ending record...\n");
+	// 1. stop recording data
+	hrt->stopRecording();
+	// 2. get gaze data as a vector and copy them into a MATLAB matrix
+	gazeDataToMatrix(hrt->getGazeData(),output);
+}
+
+void saveGazeData(EyelinkHRT *hrt, const std::string &filename){
+	if(!hrt->saveGazeData(filename)){
+		mexErrMsgTxt("ERROR: unable to write gaze data file.");
+	}
+}
+
+void loadGazeData(const std::string &filename, mxArray **output){
+	// decode a file written by 'save' (does not require a tracker connection)
+	GazeArchive archive;
+	if(!archive.open(filename)){
+		mexErrMsgTxt("ERROR: unable to read gaze data file.");
 	}
+	std::vector<GazeDatum> gd;
+	if(!archive.decodeAll(gd)){
+		mexErrMsgTxt("ERROR: the gaze data file is corrupt.");
+	}
+	gazeDataToMatrix(gd,output);
+}
+
+void getCurrentPos(EyelinkHRT *hrt,mxArray **output){
 	GazeDatum gd = hrt->getCurrentPos();
 	*output = mxCreateDoubleMatrix(3,1,mxREAL);
 	double varr[3];
 	varr[0] = gd.pos.x;
 	varr[1] = gd.pos.y;
-	varr[2] = gd.time*0.001;
+	varr[2] = gd.time*US_TO_SEC;
 	memcpy(mxGetPr(*output), varr, 3*sizeof(double));
 }
 
 
-void getCurrentTime(int tracking_eye,mxArray **output){
-	if(!is_initialized){
-		init(tracking_eye);
-	}
-	double time = hrt->getCurrentTime()*0.001;
+void getCurrentTime(EyelinkHRT *hrt,mxArray **output){
+	double time = hrt->getCurrentTime()*US_TO_SEC;
 	*output = mxCreateDoubleScalar(time);
 }
 
-void getVelocity(int tracking_eye,mxArray **output){
-	if(!is_initialized){
-		init(tracking_eye);
-	}
+void getVelocity(EyelinkHRT *hrt,mxArray **output){
 	GazeDatum gd = hrt->getCurrentVelocity();
 	Point2D vel = gd.pos;
 	double speed = vel.vlength();
-	double time = gd.time*0.001;
+	double time = gd.time*US_TO_SEC;
 	double dir = atan((vel.x+EPS)/(vel.y+EPS))*180.0/M_PI;
 	double varr[3] = {speed,time,dir};
 	*output = mxCreateDoubleMatrix(3,1,mxREAL);
 	memcpy(mxGetPr(*output), varr, 3*sizeof(double));
 }
 
+void setDisplayGeometry(EyelinkHRT *hrt, int nrhs, const mxArray *prhs[]){
+	// an empty geometry vector reverts to screen (pixel) coordinates
+	if(mxGetNumberOfElements(prhs[1])==0){
+		if(!hrt->clearDisplayGeometry()){
+			mexErrMsgTxt("ERROR: the display geometry can't be changed during a recording.");
+		}
+		return;
+	}
+	if(mxGetNumberOfElements(prhs[1])!=5){
+		mexErrMsgTxt("ERROR: the display geometry must be [width_mm height_mm res_x res_y distance_mm].");
+	}
+	double *g = mxGetPr(prhs[1]);
+	bool use_sample_resolution = (nrhs>2)&&(mxGetScalar(prhs[2])!=0);
+	if((g[0]<=0)||(g[1]<=0)||(g[2]<1)||(g[3]<1)||(g[4]<=0)){
+		mexErrMsgTxt("ERROR: all display geometry values must be positive.");
+	}
+	if(!hrt->setDisplayGeometry(g[0],g[1],(int) g[2],(int) g[3],g[4],use_sample_resolution)){
+		mexErrMsgTxt("ERROR: the display geometry can't be changed during a recording.");
+	}
+}
+
+void waitForCondition(EyelinkHRT *hrt, int nrhs, const mxArray *prhs[], mxArray **output){
+	// e.g., eyelink_hrt('wait','region',[XMIN YMIN XMAX YMAX],DURATION,TIMEOUT)
+	std::string name = std::string(mxArrayToString(prhs[1]));
+	std::transform(name.begin(),name.end(),name.begin(),::tolower);
+	GazeCondition condition;
+	int nr_params;
+	if(name=="region"){
+		nr_params = 2;
+		condition.type = GazeCondition::GAZE_IN_REGION;
+	}else if(name=="velocity"){
+		nr_params = 1;
+		condition.type = GazeCondition::VELOCITY_ABOVE;
+	}else if(name=="saccade"){
+		nr_params = 0;
+		condition.type = GazeCondition::SACCADE_ONSET;
+		if(!(hrt->getSaccadeVelocityThreshold()>0.0)){
+			mexErrMsgTxt("ERROR: saccades are only detected once a display geometry or 'saccade_threshold' is set.");
+		}
+	}else if(name=="blink_end"){
+		nr_params = 0;
+		condition.type = GazeCondition::BLINK_END;
+	}else{
+		mexErrMsgTxt("ERROR: the wait condition must be 'region', 'velocity', 'saccade', or 'blink_end'.");
+		return;
+	}
+	if(nrhs<3+nr_params){
+		mexErrMsgTxt("ERROR: missing parameters (or timeout) for the wait condition.");
+	}
+	if(condition.type==GazeCondition::GAZE_IN_REGION){
+		if(mxGetNumberOfElements(prhs[2])!=4){
+			mexErrMsgTxt("ERROR: the region must be [xmin ymin xmax ymax].");
+		}
+		double *r = mxGetPr(prhs[2]);
+		condition.region_min = Point2D(r[0],r[1]);
+		condition.region_max = Point2D(r[2],r[3]);
+		double duration = mxGetScalar(prhs[3]); // in seconds
+		if(!(duration>=0.0)||(duration>EyelinkHRT::MAX_WAIT_TIMEOUT_MS/1000.0)){
+			mexErrMsgTxt("ERROR: the region duration must be between 0 and 86400 seconds.");
+		}
+		condition.duration = (int64_t) (duration/US_TO_SEC);
+	}else if(condition.type==GazeCondition::VELOCITY_ABOVE){
+		condition.threshold = mxGetScalar(prhs[2]);
+	}
+	double timeout = mxGetScalar(prhs[2+nr_params]); // in seconds
+	if(!(timeout>=0.0)){
+		mexErrMsgTxt("ERROR: the timeout must be a nonnegative number of seconds (or Inf for no timeout).");
+	}
+	// Inf, or anything longer than a day, waits without a timeout
+	int64_t event_time;
+	if(hrt->waitFor(condition,1000.0*timeout,event_time)){
+		*output = mxCreateDoubleScalar(event_time*US_TO_SEC);
+	}else{
+		*output = mxCreateDoubleScalar(mxGetNaN());
+	}
+}
+
+void configureHeatmap(EyelinkHRT *hrt, int nrhs, const mxArray *prhs[]){
+	// eyelink_hrt('heatmap_config',[NX NY],[XMIN XMAX YMIN YMAX],SIGMA,DURATION_WEIGHTED)
+	if(mxGetNumberOfElements(prhs[1])==0){
+		hrt->configureHeatmap(0,0,0,0,0,0); // disables the heatmap
+		return;
+	}
+	if((nrhs<3)||(mxGetNumberOfElements(prhs[1])!=2)||(mxGetNumberOfElements(prhs[2])!=4)){
+		mexErrMsgTxt("ERROR: the heatmap configuration must be [nx ny],[xmin xmax ymin ymax].");
+	}
+	double *n = mxGetPr(prhs[1]);
+	double *e = mxGetPr(prhs[2]);
+	double sigma = (nrhs>3)? mxGetScalar(prhs[3]):0.0;
+	bool duration_weighting = (nrhs>4)&&(mxGetScalar(prhs[4])!=0);
+	if((n[0]<1)||(n[1]<1)||(e[1]<=e[0])||(e[3]<=e[2])){
+		mexErrMsgTxt("ERROR: the heatmap must have at least one bin and a nonempty extent.");
+	}
+	hrt->configureHeatmap((int) n[0],(int) n[1],e[0],e[1],e[2],e[3],sigma,duration_weighting);
+}
+
+void getHeatmap(EyelinkHRT *hrt, mxArray **output){
+	// returns an NY x NX matrix (rows index y, columns index x)
+	int nx, ny;
+	std::vector<double> grid = hrt->getHeatmap(nx,ny);
+	*output = mxCreateDoubleMatrix(ny,nx,mxREAL);
+	if(!grid.empty()){
+		memcpy(mxGetPr(*output), &grid[0], grid.size()*sizeof(double));
+	}
+}
+
+void getQualityMetrics(EyelinkHRT *hrt, mxArray **output){
+	// returns [rms_s2s; fixation_sd; data_loss; sampling_rate; nr_samples]
+	GazeQualityMetrics metrics = hrt->getQualityMetrics();
+	double varr[5] = {metrics.rms_s2s,metrics.fixation_sd,metrics.data_loss,
+		metrics.sampling_rate,(double) metrics.nr_samples};
+	*output = mxCreateDoubleMatrix(5,1,mxREAL);
+	memcpy(mxGetPr(*output), varr, 5*sizeof(double));
+}
+
 static void cleanup(){
-	if(is_initialized){
+	if(!trackers.empty()){
 		printf("\n...ending tracking...\n");
-		hrt->stopTracking();
-		printf("\n...deleting HRT...\n");
-		delete hrt;
-		delete lt;
-		is_initialized = false;
-		mexUnlock();
+	}
+	while(!trackers.empty()){
+		closeTracker(trackers.begin()->first);
 	}
 }
 
@@ -111,6 +312,13 @@ static void cleanup(){
 void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]){ // Entry point from Matlab to C
 	std::string command;
 	int tracking_eye;
+	int handle = DEFAULT_HANDLE;
+	// A leading numeric argument selects the tracker, e.g. eyelink_hrt(h,'position')
+	if((nrhs>0)&&!mxIsChar(prhs[0])){
+		handle = (int) mxGetScalar(prhs[0]);
+		++prhs;
+		--nrhs;
+	}
     /* Check for proper number of arguments */
     if(nrhs<1){ 
 		mexErrMsgTxt("ERROR: At least one input argument is required."); 
@@ -126,35 +334,89 @@ void mexFunction( int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]){ /
 			mexErrMsgTxt("ERROR: the second parameter must indicate the tracked eye (0=left;1=right).");
 		}else{
 			tracking_eye = mxGetScalar(prhs[1]);
-			startRecording(tracking_eye);
+			startRecording(getTracker(handle,tracking_eye),tracking_eye);
 		}
 	}else if(command=="stop"){
-		stopRecording(plhs);
-	}else if(command=="cleanup"){
-		cleanup(); 
-		// disabled (5/16/2017); this could lead to attempted deletion of null pointer
-		//mexErrMsgTxt("ERROR: the 'cleanup' command is deprecated");
-	}else if(command=="time"){
+		stopRecording(findTracker(handle),plhs);
+	}else if(command=="open"){
 		if(nrhs<2){
-			mexErrMsgTxt("ERROR: the second parameter must indicate the tracked eye (0=left;1=right).");
+			mexErrMsgTxt("ERROR: the second parameter must indicate the tracked eye (0=left;1=right) or 'replay'.");
 		}else{
-			tracking_eye = mxGetScalar(prhs[0]);
-			getCurrentTime(tracking_eye,plhs);
+			plhs[0] = mxCreateDoubleScalar(openTracker(nrhs,prhs));
 		}
-	}else if(command=="position"){
+	}else if(command=="close"){
+		closeTracker(handle);
+	}else if(command=="save"){
 		if(nrhs<2){
-			mexErrMsgTxt("ERROR: the second parameter must indicate the tracked eye (0=left;1=right).");
+			mexErrMsgTxt("ERROR: the second parameter must be a file name.");
 		}else{
-			tracking_eye = mxGetScalar(prhs[0]);
-			getCurrentPos(tracking_eye,plhs);
+			saveGazeData(findTracker(handle),std::string(mxArrayToString(prhs[1])));
 		}
-	}else if(command=="velocity"){
+	}else if(command=="load"){
 		if(nrhs<2){
-			mexErrMsgTxt("ERROR: the second parameter must indicate the tracked eye (0=left;1=right).");
+			mexErrMsgTxt("ERROR: the second parameter must be a file name.");
+		}else{
+			loadGazeData(std::string(mxArrayToString(prhs[1])),plhs);
+		}
+	}else if(command=="geometry"){
+		if(nrhs<2){
+			mexErrMsgTxt("ERROR: the second parameter must be [width_mm height_mm res_x res_y distance_mm] (or [] to clear).");
+		}else{
+			setDisplayGeometry(getTracker(handle,DEFAULT_EYE),nrhs,prhs);
+		}
+	}else if(command=="saccade_threshold"){
+		if(nrhs<2){
+			mexErrMsgTxt("ERROR: the second parameter must be a velocity threshold (deg/sec, or pixels/sec without a display geometry).");
+		}else if(!getTracker(handle,DEFAULT_EYE)->setSaccadeVelocityThreshold(mxGetScalar(prhs[1]))){
+			mexErrMsgTxt("ERROR: the saccade threshold can't be changed during a recording.");
+		}
+	}else if(command=="wait"){
+		if(nrhs<2){
+			mexErrMsgTxt("ERROR: the second parameter must be a wait condition (e.g., 'saccade').");
+		}else{
+			waitForCondition(findTracker(handle),nrhs,prhs,plhs);
+		}
+	}else if(command=="heatmap_config"){
+		if(nrhs<2){
+			mexErrMsgTxt("ERROR: the second parameter must be the heatmap size [nx ny] (or [] to disable).");
 		}else{
-			tracking_eye = mxGetScalar(prhs[0]);
-			getVelocity(tracking_eye,plhs);
+			configureHeatmap(getTracker(handle,DEFAULT_EYE),nrhs,prhs);
 		}
+	}else if(command=="heatmap"){
+		getHeatmap(findTracker(handle),plhs);
+	}else if(command=="heatmap_reset"){
+		findTracker(handle)->resetHeatmap();
+	}else if(command=="quality"){
+		getQualityMetrics(findTracker(handle),plhs);
+	}else if(command=="quality_window"){
+		if(nrhs<2){
+			mexErrMsgTxt("ERROR: the second parameter must be the window size (in samples).");
+		}else{
+			getTracker(handle,DEFAULT_EYE)->setQualityWindow((size_t) mxGetScalar(prhs[1]));
+		}
+	}else if(command=="drain_link"){
+		// applies to every tracker reading from the Eyelink (see LiteTracker.h)
+		if(nrhs<2){
+			mexErrMsgTxt("ERROR: the second parameter must be 1 (read every queued sample) or 0 (read only the newest sample).");
+		}else{
+			LiteTracker::setLinkDraining(mxGetScalar(prhs[1])!=0);
+		}
+	}else if(command=="cleanup"){
+		cleanup(); 
+		// disabled (5/16/2017); this could lead to attempted deletion of null pointer
+		//mexErrMsgTxt("ERROR: the 'cleanup' command is deprecated");
+	}else if(command=="time"){
+		// the tracked eye is only needed if the default tracker hasn't been started
+		tracking_eye = (nrhs<2)? -1:(int) mxGetScalar(prhs[1]);
+		getCurrentTime(getTracker(handle,tracking_eye),plhs);
+	}else if(command=="position"){
+		// the tracked eye is only needed if the default tracker hasn't been started
+		tracking_eye = (nrhs<2)? -1:(int) mxGetScalar(prhs[1]);
+		getCurrentPos(getTracker(handle,tracking_eye),plhs);
+	}else if(command=="velocity"){
+		// the tracked eye is only needed if the default tracker hasn't been started
+		tracking_eye = (nrhs<2)? -1:(int) mxGetScalar(prhs[1]);
+		getVelocity(getTracker(handle,tracking_eye),plhs);
 	}else{
 		mexErrMsgTxt("ERROR: an input string (e.g., 'start', 'stop', or 'position') is required.");
 	}
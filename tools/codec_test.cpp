@@ -0,0 +1,465 @@
+// codec_test.cpp
+// Round-trip and corruption tests for the session file format (GazeCodec.h).
+// Like hrt_batch, it needs neither MATLAB nor the Eyelink SDK; 'make test'
+// builds and runs it. Build it with -fsanitize=address (see the makefile) to
+// have the corruption tests also catch out-of-bounds reads.
+//
+// usage: codec_test [nr_random_corruptions]
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include "GazeCodec.h"
+
+using std::string;
+using std::vector;
+typedef std::pair<int64_t,int64_t> FlagRun; // (flags, run length)
+
+static const char *current_test = "";
+static int nr_failures = 0;
+
+#define CHECK(cond) check((cond),#cond,__LINE__)
+
+static bool check(bool ok, const char *what, int line){
+	if(!ok){
+		fprintf(stderr,"FAILED (%s, line %d): %s\n",current_test,line,what);
+		++nr_failures;
+	}
+	return ok;
+}
+
+// deterministic pseudo-random numbers, so that failures can be reproduced
+static uint64_t rng_state = 0x9e3779b97f4a7c15ULL;
+static uint32_t nextRandom(){
+	rng_state = rng_state*6364136223846793005ULL+1442695040888963407ULL;
+	return (uint32_t)(rng_state>>33);
+}
+
+// A fake recording: a ~1 kHz clock with some jitter and dropouts, a random
+// walk in position with occasional saccade-sized jumps, and blink runs.
+static vector<GazeDatum> makeRecording(size_t n){
+	vector<GazeDatum> data(n);
+	int64_t t = 123456789;
+	Point2D pos(640.0,512.0);
+	unsigned int flags = 0;
+	for(size_t i=0;i<n;++i){
+		t += (nextRandom()%50==0)? 5000+nextRandom()%3000:1000+(int64_t)(nextRandom()%3)-1;
+		if(nextRandom()%200==0){
+			pos = Point2D(nextRandom()%1280,nextRandom()%1024);
+		}else{
+			pos = Point2D(pos.x+(nextRandom()%201-100)*0.001,pos.y+(nextRandom()%201-100)*0.001);
+		}
+		if(nextRandom()%100==0){
+			flags = (flags==0)? (nextRandom()%3+1):0;
+		}
+		data[i] = GazeDatum(pos,t,flags);
+	}
+	return data;
+}
+
+static bool sameData(const vector<GazeDatum> &a, const vector<GazeDatum> &b, double resolution){
+	if(a.size()!=b.size()){
+		return false;
+	}
+	for(size_t i=0;i<a.size();++i){
+		if((a[i].time!=b[i].time)||(a[i].flags!=b[i].flags)||
+			(fabs(a[i].pos.x-b[i].pos.x)>0.5001*resolution)||
+			(fabs(a[i].pos.y-b[i].pos.y)>0.5001*resolution)){
+			return false;
+		}
+	}
+	return true;
+}
+
+/// A minimal, independent writer for the file layout described in
+/// GazeCodec.h, used to produce files as older versions of the codec wrote
+/// them, and blocks with deliberately damaged contents.
+static void putFixed(vector<unsigned char> &out, uint64_t v, int nbytes){
+	for(int i=0;i<nbytes;++i){
+		out.push_back((unsigned char)(v>>(8*i)));
+	}
+}
+
+static void putDouble(vector<unsigned char> &out, double d){
+	uint64_t bits;
+	memcpy(&bits,&d,sizeof(bits));
+	putFixed(out,bits,8);
+}
+
+static void putVarint(vector<unsigned char> &out, int64_t v){
+	uint64_t u = (uint64_t(v)<<1)^uint64_t(v>>63);
+	while(u>=0x80){
+		out.push_back((unsigned char)(u|0x80));
+		u >>= 7;
+	}
+	out.push_back((unsigned char)u);
+}
+
+struct RawBlock{
+	int64_t first_time;	// in file ticks
+	uint32_t nr_samples;
+	vector<unsigned char> bytes;
+};
+
+// Encodes data[first,first+n) with times divided by 'tick_us'. Flag runs are
+// written (from 'runs' if non-NULL, otherwise from the data) unless 'runs' is
+// NULL and 'with_flags' is false, as in version 1 files.
+static RawBlock rawBlock(const vector<GazeDatum> &data, size_t first, size_t n, int64_t tick_us,
+	double scale, bool with_flags, const vector<FlagRun> *runs=NULL){
+	RawBlock block;
+	block.first_time = data[first].time/tick_us;
+	block.nr_samples = (uint32_t) n;
+	int64_t prev_t = 0, prev_dt = 0, prev_x = 0, prev_y = 0;
+	for(size_t i=first;i<first+n;++i){
+		const int64_t t = data[i].time/tick_us;
+		const int64_t x = (int64_t) floor(data[i].pos.x*scale+0.5);
+		const int64_t y = (int64_t) floor(data[i].pos.y*scale+0.5);
+		if(i==first){
+			putVarint(block.bytes,t);
+		}else{
+			putVarint(block.bytes,(t-prev_t)-prev_dt);
+			prev_dt = t-prev_t;
+		}
+		putVarint(block.bytes,x-prev_x);
+		putVarint(block.bytes,y-prev_y);
+		prev_t = t;
+		prev_x = x;
+		prev_y = y;
+	}
+	vector<FlagRun> data_runs;
+	if(runs==NULL){
+		if(!with_flags){
+			return block;
+		}
+		for(size_t i=first;i<first+n;++i){
+			if(data_runs.empty()||(data_runs.back().first!=data[i].flags)){
+				data_runs.push_back(FlagRun(data[i].flags,0));
+			}
+			++data_runs.back().second;
+		}
+		runs = &data_runs;
+	}
+	putVarint(block.bytes,runs->size());
+	for(size_t r=0;r<runs->size();++r){
+		putVarint(block.bytes,(*runs)[r].first);
+		putVarint(block.bytes,(*runs)[r].second);
+	}
+	return block;
+}
+
+static vector<unsigned char> rawFile(uint32_t version, uint32_t ticks_per_second, double scale,
+	uint32_t block_size, const vector<RawBlock> &blocks){
+	vector<unsigned char> out;
+	uint64_t nr_samples = 0;
+	for(size_t b=0;b<blocks.size();++b){
+		nr_samples += blocks[b].nr_samples;
+	}
+	out.push_back('E'); out.push_back('H'); out.push_back('R'); out.push_back('T');
+	putFixed(out,version,4);
+	putFixed(out,ticks_per_second,4);
+	putDouble(out,scale);
+	putFixed(out,block_size,4);
+	putFixed(out,nr_samples,8);
+	putFixed(out,blocks.size(),4);
+	const size_t index_offset_pos = out.size();
+	putFixed(out,0,8);
+	if(version>=3){
+		putFixed(out,GAZE_UNITS_PIXELS,4);
+		putDouble(out,0.0);
+	}
+	vector<uint64_t> offsets;
+	for(size_t b=0;b<blocks.size();++b){
+		offsets.push_back(out.size());
+		out.insert(out.end(),blocks[b].bytes.begin(),blocks[b].bytes.end());
+	}
+	const uint64_t index_offset = out.size();
+	for(size_t b=0;b<blocks.size();++b){
+		putFixed(out,offsets[b],8);
+		putFixed(out,uint64_t(blocks[b].first_time),8);
+		putFixed(out,blocks[b].nr_samples,4);
+	}
+	for(int i=0;i<8;++i){
+		out[index_offset_pos+i] = (unsigned char)(index_offset>>(8*i));
+	}
+	return out;
+}
+
+// Attaches to and decodes 'buffer'; returns false if either step fails
+static bool decodeBuffer(const vector<unsigned char> &buffer, vector<GazeDatum> &out){
+	GazeArchive archive;
+	out.clear();
+	return archive.attach(buffer.empty()? NULL:&buffer[0],buffer.size())&&archive.decodeAll(out);
+}
+
+
+///////////////////////////////////////////////////////
+////////// Tests //////////////////////////////////////
+static void testRoundTrip(){
+	// sample counts on both sides of the block boundaries
+	current_test = "round trip";
+	const uint32_t block_size = 16;
+	const size_t counts[] = {1,2,15,16,17,31,32,33,160,1000};
+	for(size_t c=0;c<sizeof(counts)/sizeof(counts[0]);++c){
+		vector<GazeDatum> data = makeRecording(counts[c]);
+		GazeCodec codec(0.01,block_size);
+		vector<unsigned char> buffer;
+		codec.encode(data,buffer);
+		GazeArchive archive;
+		vector<GazeDatum> decoded;
+		CHECK(archive.attach(&buffer[0],buffer.size()));
+		CHECK(archive.size()==data.size());
+		CHECK(archive.nrBlocks()==(data.size()+block_size-1)/block_size);
+		CHECK(archive.decodeAll(decoded));
+		CHECK(sameData(data,decoded,0.01));
+		// each block on its own, and a range that straddles a block boundary
+		for(size_t b=0;b<archive.nrBlocks();++b){
+			vector<GazeDatum> block_data;
+			CHECK(archive.decodeBlock(b,block_data));
+			CHECK(block_data.size()==archive.getBlockInfo(b).nr_samples);
+			CHECK(!block_data.empty()&&(block_data[0].time==data[b*block_size].time));
+		}
+		if(data.size()>block_size+4){
+			const int64_t start = data[block_size-3].time, end = data[block_size+3].time;
+			vector<GazeDatum> range;
+			CHECK(archive.decodeRange(start,end,range));
+			CHECK(sameData(vector<GazeDatum>(data.begin()+block_size-3,data.begin()+block_size+4),
+				range,0.01));
+		}
+	}
+	// the default block size, with a count that isn't a multiple of it
+	vector<GazeDatum> data = makeRecording(3*GazeCodec::DEFAULT_BLOCK_SIZE+7);
+	vector<unsigned char> buffer;
+	GazeCodec().encode(data,buffer);
+	vector<GazeDatum> decoded;
+	CHECK(decodeBuffer(buffer,decoded));
+	CHECK(sameData(data,decoded,0.01));
+}
+
+static void testEmptyRecording(){
+	current_test = "empty recording";
+	vector<GazeDatum> data;
+	vector<unsigned char> buffer;
+	GazeCodec().encode(data,buffer);
+	GazeArchive archive;
+	vector<GazeDatum> decoded;
+	CHECK(archive.attach(&buffer[0],buffer.size()));
+	CHECK((archive.size()==0)&&(archive.nrBlocks()==0));
+	CHECK(archive.decodeAll(decoded)&&decoded.empty());
+	CHECK(archive.decodeRange(0,1000000,decoded)&&decoded.empty());
+	CHECK(!archive.decodeBlock(0,decoded));
+}
+
+static void testRecordingSettings(){
+	current_test = "version 3 header";
+	vector<GazeDatum> data = makeRecording(100);
+	GazeCodec codec(0.001);
+	codec.setRecordingSettings(GAZE_UNITS_DEGREES,30.0);
+	vector<unsigned char> buffer;
+	codec.encode(data,buffer);
+	GazeArchive archive;
+	CHECK(archive.attach(&buffer[0],buffer.size()));
+	CHECK(archive.getUnits()==GAZE_UNITS_DEGREES);
+	CHECK(archive.getSaccadeVelocityThreshold()==30.0);
+	CHECK(fabs(archive.getResolution()-0.001)<1e-12);
+	// saccade classification off
+	codec = GazeCodec(0.01);
+	codec.setRecordingSettings(GAZE_UNITS_PIXELS,0.0);
+	codec.encode(data,buffer);
+	CHECK(archive.attach(&buffer[0],buffer.size()));
+	CHECK(archive.getUnits()==GAZE_UNITS_PIXELS);
+	CHECK(archive.getSaccadeVelocityThreshold()==0.0);
+}
+
+static void testOlderVersions(){
+	const uint32_t block_size = 16;
+	vector<GazeDatum> data = makeRecording(40);
+	// version 1, as first written: millisecond ticks and no flags
+	current_test = "version 1 header (ms ticks)";
+	vector<GazeDatum> ms_data = data;
+	for(size_t i=0;i<ms_data.size();++i){
+		ms_data[i].time = 1000*(ms_data[i].time/1000);
+		ms_data[i].flags = 0;
+	}
+	vector<RawBlock> blocks;
+	for(size_t first=0;first<data.size();first+=block_size){
+		blocks.push_back(rawBlock(ms_data,first,std::min<size_t>(block_size,data.size()-first),1000,100.0,false));
+	}
+	vector<unsigned char> buffer = rawFile(1,1000,100.0,block_size,blocks);
+	GazeArchive archive;
+	vector<GazeDatum> decoded;
+	CHECK(archive.attach(&buffer[0],buffer.size()));
+	CHECK(archive.getTicksPerSecond()==1000);
+	CHECK(archive.getUnits()==GAZE_UNITS_UNKNOWN);
+	CHECK(archive.getSaccadeVelocityThreshold()==0.0);
+	CHECK(archive.decodeAll(decoded));
+	CHECK(sameData(ms_data,decoded,0.01));
+	CHECK(archive.getBlockInfo(1).first_time==ms_data[block_size].time);
+
+	// version 1 with microsecond ticks (still no flags)
+	current_test = "version 1 header (us ticks)";
+	vector<GazeDatum> unflagged = data;
+	for(size_t i=0;i<unflagged.size();++i){
+		unflagged[i].flags = 0;
+	}
+	blocks.clear();
+	for(size_t first=0;first<data.size();first+=block_size){
+		blocks.push_back(rawBlock(unflagged,first,std::min<size_t>(block_size,data.size()-first),1,100.0,false));
+	}
+	buffer = rawFile(1,1000000,100.0,block_size,blocks);
+	CHECK(decodeBuffer(buffer,decoded));
+	CHECK(sameData(unflagged,decoded,0.01));
+
+	// version 2: adds the flag runs
+	current_test = "version 2 header";
+	blocks.clear();
+	for(size_t first=0;first<data.size();first+=block_size){
+		blocks.push_back(rawBlock(data,first,std::min<size_t>(block_size,data.size()-first),1,1000.0,true));
+	}
+	buffer = rawFile(2,1000000,1000.0,block_size,blocks);
+	CHECK(archive.attach(&buffer[0],buffer.size()));
+	CHECK(archive.getUnits()==GAZE_UNITS_UNKNOWN);
+	CHECK(fabs(archive.getResolution()-0.001)<1e-12);
+	decoded.clear();
+	CHECK(archive.decodeAll(decoded));
+	CHECK(sameData(data,decoded,0.001));
+
+	// versions this codec doesn't know about
+	current_test = "unknown version";
+	buffer = rawFile(GazeCodec::FORMAT_VERSION+1,1000000,1000.0,block_size,blocks);
+	CHECK(!decodeBuffer(buffer,decoded));
+	buffer = rawFile(0,1000000,1000.0,block_size,blocks);
+	CHECK(!decodeBuffer(buffer,decoded));
+}
+
+static void testFlagRuns(){
+	// the flag runs must cover a block's samples exactly
+	current_test = "flag runs";
+	const size_t n = 8;
+	vector<GazeDatum> data = makeRecording(n);
+	struct RunCase{
+		const char *name;
+		FlagRun runs[3];
+		size_t nr_runs;
+		bool valid;
+		unsigned int last_flags;	// of the final sample, if valid
+	};
+	const RunCase cases[] = {
+		{"exact",{FlagRun(0,3),FlagRun(GazeDatum::GAZE_BLINK,5)},2,true,GazeDatum::GAZE_BLINK},
+		{"too long",{FlagRun(0,9)},1,false,0},
+		{"too short",{FlagRun(0,5)},1,false,0},
+		{"sum too long",{FlagRun(0,5),FlagRun(1,5)},2,false,0},
+		{"negative",{FlagRun(0,-1),FlagRun(1,9)},2,false,0},
+		{"huge",{FlagRun(0,int64_t(1)<<62)},1,false,0},
+		{"no runs",{FlagRun(0,0)},0,false,0},
+		{"trailing empty run",{FlagRun(GazeDatum::GAZE_INVALID,8),FlagRun(1,0)},2,true,GazeDatum::GAZE_INVALID}
+	};
+	for(size_t c=0;c<sizeof(cases)/sizeof(cases[0]);++c){
+		current_test = cases[c].name;
+		vector<FlagRun> runs(cases[c].runs,cases[c].runs+cases[c].nr_runs);
+		for(uint32_t version=2;version<=GazeCodec::FORMAT_VERSION;++version){
+			vector<RawBlock> blocks(1,rawBlock(data,0,n,1,100.0,true,&runs));
+			vector<unsigned char> buffer = rawFile(version,1000000,100.0,16,blocks);
+			vector<GazeDatum> decoded;
+			GazeArchive archive;
+			CHECK(archive.attach(&buffer[0],buffer.size()));
+			CHECK(archive.decodeAll(decoded)==cases[c].valid);
+			CHECK(decoded.size()==(cases[c].valid? n:0));
+			if(cases[c].valid){
+				CHECK(decoded[n-1].flags==cases[c].last_flags);
+			}
+		}
+	}
+	// more runs promised than the block holds, and a run length cut off mid-varint
+	current_test = "truncated runs";
+	vector<FlagRun> runs(1,FlagRun(0,n));
+	RawBlock block = rawBlock(data,0,n,1,100.0,true,&runs);
+	RawBlock missing = block;
+	missing.bytes.resize(missing.bytes.size()-3); // drop the run (and the run count)
+	putVarint(missing.bytes,1000000);
+	vector<GazeDatum> decoded;
+	CHECK(!decodeBuffer(rawFile(2,1000000,100.0,16,vector<RawBlock>(1,missing)),decoded));
+	runs[0].second = 300; // a two-byte varint...
+	block = rawBlock(data,0,n,1,100.0,true,&runs);
+	block.bytes.pop_back(); // ...missing its last byte
+	CHECK(!decodeBuffer(rawFile(2,1000000,100.0,16,vector<RawBlock>(1,block)),decoded));
+}
+
+static void testTruncatedFiles(){
+	// no proper prefix of a file is a valid file, since the index comes last
+	current_test = "truncated files";
+	vector<GazeDatum> data = makeRecording(100);
+	vector<unsigned char> buffer;
+	GazeCodec(0.01,16).encode(data,buffer);
+	GazeArchive archive;
+	size_t nr_accepted = 0;
+	for(size_t len=0;len<buffer.size();++len){
+		vector<unsigned char> prefix(buffer.begin(),buffer.begin()+len);
+		if(archive.attach(prefix.empty()? NULL:&prefix[0],prefix.size())){
+			++nr_accepted;
+		}
+	}
+	CHECK(nr_accepted==0);
+	// a block whose samples end early is caught while decoding
+	vector<RawBlock> blocks(1,rawBlock(data,0,16,1,100.0,true));
+	blocks[0].bytes.resize(blocks[0].bytes.size()-4);
+	vector<GazeDatum> decoded;
+	CHECK(!decodeBuffer(rawFile(2,1000000,100.0,16,blocks),decoded));
+	CHECK(decoded.empty());
+}
+
+static void testRandomCorruption(size_t nr_trials){
+	// Damaged files must either be rejected or decode to the promised number of
+	// samples; they must never crash the reader (or, under ASan, read out of bounds).
+	current_test = "random corruption";
+	vector<GazeDatum> data = makeRecording(300);
+	vector<unsigned char> original;
+	GazeCodec codec(0.01,32);
+	codec.setRecordingSettings(GAZE_UNITS_PIXELS,100.0);
+	codec.encode(data,original);
+	size_t nr_decoded = 0;
+	for(size_t trial=0;trial<nr_trials;++trial){
+		vector<unsigned char> buffer = original;
+		const int nr_changes = 1+nextRandom()%4;
+		for(int i=0;i<nr_changes;++i){
+			buffer[nextRandom()%buffer.size()] = (unsigned char) nextRandom();
+		}
+		if(nextRandom()%8==0){
+			buffer.resize(nextRandom()%buffer.size());
+		}
+		GazeArchive archive;
+		if(!archive.attach(buffer.empty()? NULL:&buffer[0],buffer.size())){
+			continue;
+		}
+		vector<GazeDatum> decoded;
+		if(archive.decodeAll(decoded)){
+			CHECK(decoded.size()==archive.size());
+			++nr_decoded;
+		}else{
+			CHECK(decoded.empty());
+		}
+		vector<GazeDatum> range;
+		archive.decodeRange(data[50].time,data[150].time,range);
+	}
+	printf("   %lu of %lu damaged files decoded\n",(unsigned long) nr_decoded,(unsigned long) nr_trials);
+}
+
+int main(int argc, char *argv[]){
+	const size_t nr_trials = (argc>1)? (size_t) strtoul(argv[1],NULL,10):20000;
+	testRoundTrip();
+	testEmptyRecording();
+	testRecordingSettings();
+	testOlderVersions();
+	testFlagRuns();
+	testTruncatedFiles();
+	testRandomCorruption(nr_trials);
+	if(nr_failures>0){
+		printf("codec_test: %d check(s) FAILED\n",nr_failures);
+		return 1;
+	}
+	printf("codec_test: all checks passed\n");
+	return 0;
+}
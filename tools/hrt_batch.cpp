@@ -0,0 +1,81 @@
+// hrt_batch.cpp
+// Standalone command-line front end for GazeBatch: reanalyzes recorded
+// session files (one trial per file) in parallel and reports throughput.
+//
+// usage: hrt_batch [-j threads] [-t saccade_threshold] [-o output_dir] [-e] files...
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include "GazeBatch.h"
+
+static void usage(){
+	printf("usage: hrt_batch [-j threads] [-t saccade_threshold] [-o output_dir] [-e] files...\n");
+	printf("  -j  number of worker threads, 1 to 1024 (default: one per core)\n");
+	printf("  -t  saccade velocity threshold, in the files' position units/sec; 0 turns\n");
+	printf("      saccade detection off (default: the threshold each file was recorded with)\n");
+	printf("  -o  directory for the output files, created if needed (default: next to each input file)\n");
+	printf("  -e  write only the event tables (skip the per-sample kinematics)\n");
+}
+
+// Parses all of 'arg' as a number; returns false if it isn't one
+static bool parseNumber(const char *arg, double &value){
+	char *end;
+	value = strtod(arg,&end);
+	return (end!=arg)&&(*end=='\0');
+}
+
+static int badArgument(const char *option, const char *arg, const char *expected){
+	fprintf(stderr,"hrt_batch: invalid argument '%s' for %s (expected %s)\n",arg,option,expected);
+	return 1;
+}
+
+int main(int argc, char *argv[]){
+	unsigned int nr_threads = 0;
+	double threshold = GazeBatch::RECORDED_THRESHOLD;
+	std::string output_dir;
+	bool write_kinematics = true;
+	std::vector<std::string> filenames;
+
+	for(int i=1;i<argc;++i){
+		std::string arg(argv[i]);
+		double value;
+		if((arg=="-j")&&(i+1<argc)){
+			++i;
+			if(!parseNumber(argv[i],value)||(value<1)||(value>1024)||(value!=floor(value))){
+				return badArgument("-j",argv[i],"a number of threads from 1 to 1024");
+			}
+			nr_threads = (unsigned int) value;
+		}else if((arg=="-t")&&(i+1<argc)){
+			++i;
+			if(!parseNumber(argv[i],value)||!(value>=0)||!(value<HUGE_VAL)){
+				return badArgument("-t",argv[i],"a nonnegative velocity");
+			}
+			threshold = value;
+		}else if((arg=="-o")&&(i+1<argc)){
+			output_dir = argv[++i];
+		}else if(arg=="-e"){
+			write_kinematics = false;
+		}else if((arg=="-h")||(arg=="--help")||(arg[0]=='-')){
+			usage();
+			return (arg[0]=='-')&&(arg!="-h")&&(arg!="--help");
+		}else{
+			filenames.push_back(arg);
+		}
+	}
+	if(filenames.empty()){
+		usage();
+		return 1;
+	}
+
+	GazeBatch batch(threshold);
+	batch.setOutputDirectory(output_dir);
+	batch.setWriteKinematics(write_kinematics);
+	GazeBatchStats stats = batch.run(filenames,nr_threads);
+
+	printf("processed %lu files (%lu failed), %llu samples in %.3f s (%.3g samples/sec)\n",
+		(unsigned long) stats.nr_files,(unsigned long) stats.nr_failed,
+		(unsigned long long) stats.nr_samples,stats.elapsed_time,stats.samples_per_sec);
+	return (stats.nr_failed>0)? 1:0;
+}